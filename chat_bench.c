@@ -0,0 +1,492 @@
+// End-to-end load generator for chat_server
+// Simulates many clients from one process over loopback: each gets its own UDP socket and conn$ name, then the
+// clients send a mix of say$, sayto$, mute$ and rename$ at a target rate. Every say$ carries its sender and send
+// time, so the copies the other clients receive give the broadcast latency; the bench keeps its own model of who
+// has muted whom, so it also knows how many copies should have arrived (loss) and how fast they did (throughput).
+// Results are printed as one JSON object, so runs against different server versions can be compared.
+//
+// Build: gcc -O2 chat_bench.c -o chat_bench
+// Run:   ./chat_server -L none &
+//        ./chat_bench [-c clients] [-r rate] [-d seconds] [-m mix] [-s server_ip] [-p port] [-S seed] [-o json_file]
+
+// udp.h uses recvmmsg/sendmmsg, which are GNU extensions
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include "udp.h"
+
+#define DEFAULT_CLIENTS 50
+#define DEFAULT_RATE 1000    // Requests per second, over all clients together
+#define DEFAULT_DURATION 5   // Seconds of load
+#define DEFAULT_MIX "say:85,sayto:10,mute:3,rename:2"
+#define DEFAULT_SEED 1
+#define CONNECT_TIMEOUT_MS 2000 // How long to wait for every conn$ to be answered
+#define DRAIN_MS 1000           // How long to keep receiving after the load, for messages still in flight
+#define BENCH_NAME_LEN 32
+#define BENCH_MAX_MUTES 16      // Names one simulated client mutes at most
+#define BENCH_SOCKET_BUFFER (1 << 20) // Receive buffer per client, so the bench itself does not drop broadcasts
+
+typedef enum {
+    OP_SAY,
+    OP_SAYTO,
+    OP_MUTE,
+    OP_RENAME,
+    OP_COUNT
+} bench_op_t;
+
+const char *op_names[OP_COUNT] = {"say", "sayto", "mute", "rename"};
+
+typedef struct {
+    int socket_descriptor;
+    char name[BENCH_NAME_LEN];
+    int connected;
+    int renames;
+    char muted[BENCH_MAX_MUTES][BENCH_NAME_LEN]; // Names this client has muted (the bench's model of the server's)
+    int mute_count;
+} bench_client_t;
+
+typedef struct {
+    int client_count;
+    int rate;
+    int duration;
+    int mix[OP_COUNT]; // Weight of each request type
+    const char *server_ip;
+    int port;
+    uint64_t seed;
+    const char *output_path;
+} bench_config_t;
+
+bench_config_t bench_config = {
+    DEFAULT_CLIENTS,
+    DEFAULT_RATE,
+    DEFAULT_DURATION,
+    {0},
+    "127.0.0.1",
+    SERVER_PORT,
+    DEFAULT_SEED,
+    NULL
+};
+
+typedef struct {
+    unsigned long sent[OP_COUNT];
+    unsigned long say_expected;    // Copies of our say$ messages the model says should arrive
+    unsigned long say_delivered;   // Copies that did (during the load or the drain after it)
+    unsigned long sayto_delivered; // sayto$ messages that reached their recipient
+    unsigned long errors;          // Error$ replies
+    unsigned long datagrams;       // Everything received after connecting
+    uint64_t *latencies;           // ns from sending a say$ to each copy arriving
+    size_t latency_count;
+    size_t latency_capacity;
+} bench_results_t;
+
+bench_client_t *clients;
+bench_results_t results;
+struct sockaddr_in server_address;
+int epoll_fd;
+uint64_t random_state;
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64: the same seed gives the same sequence of requests
+uint64_t next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+int random_below(int n) {
+    return (int)(next_random() % (uint64_t)n);
+}
+
+// Parse a mix such as "say:85,sayto:10,mute:3,rename:2" into bench_config.mix
+// Returns 0 on success, -1 if it names an unknown request or has no weight at all
+int parse_mix(const char *mix) {
+    memset(bench_config.mix, 0, sizeof(bench_config.mix));
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", mix);
+    int total = 0;
+    for (char *item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+        char *colon = strchr(item, ':');
+        if (colon == NULL) {
+            return -1;
+        }
+        *colon = '\0';
+        int op = 0;
+        while (op < OP_COUNT && strcmp(op_names[op], item) != 0) {
+            op++;
+        }
+        int weight = atoi(colon + 1);
+        if (op == OP_COUNT || weight < 0) {
+            return -1;
+        }
+        bench_config.mix[op] = weight;
+        total += weight;
+    }
+    return total > 0 ? 0 : -1;
+}
+
+void send_request(int client, const char *request) {
+    udp_socket_write(clients[client].socket_descriptor, &server_address, (char *)request, strlen(request));
+}
+
+void record_latency(uint64_t latency) {
+    if (results.latency_count == results.latency_capacity) {
+        size_t capacity = results.latency_capacity == 0 ? 65536 : results.latency_capacity * 2;
+        uint64_t *grown = (uint64_t *)realloc(results.latencies, sizeof(uint64_t) * capacity);
+        if (grown == NULL) {
+            return; // Keep counting deliveries, just without this sample
+        }
+        results.latencies = grown;
+        results.latency_capacity = capacity;
+    }
+    results.latencies[results.latency_count++] = latency;
+}
+
+int is_muted(bench_client_t *client, const char *name) {
+    for (int i = 0; i < client->mute_count; i++) {
+        if (strcmp(client->muted[i], name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A connected client other than sender, or -1 if there is none
+int pick_other_client(int sender) {
+    for (int attempt = 0; attempt < 8; attempt++) {
+        int other = random_below(bench_config.client_count);
+        if (other != sender && clients[other].connected) {
+            return other;
+        }
+    }
+    return -1;
+}
+
+// Handle one datagram received by a client
+void handle_datagram(int client, char *datagram, uint64_t received_ns) {
+    results.datagrams++;
+    if (strncmp(datagram, "say$ ", 5) == 0) {
+        // "say$ [seq] name: B<sender>:<send ns>" (other say$ messages, such as announcements, are not ours)
+        const char *tag = strstr(datagram, ": B");
+        int sender;
+        unsigned long long sent_ns;
+        if (tag != NULL && sscanf(tag + 3, "%d:%llu", &sender, &sent_ns) == 2) {
+            results.say_delivered++;
+            record_latency(received_ns - sent_ns);
+        }
+    } else if (strncmp(datagram, "sayto$ ", 7) == 0) {
+        // The sender gets a copy too; only the recipient's counts
+        const char *tag = strstr(datagram, ": B");
+        int sender;
+        if (tag != NULL && sscanf(tag + 3, "%d:", &sender) == 1 && sender != client) {
+            results.sayto_delivered++;
+        }
+    } else if (strncmp(datagram, "conn$ ", 6) == 0) {
+        clients[client].connected = 1;
+    } else if (strncmp(datagram, "ping$", 5) == 0) {
+        send_request(client, "ret-ping$");
+    } else if (strncmp(datagram, "Error$", 6) == 0) {
+        results.errors++;
+    }
+}
+
+// Receive whatever has arrived, waiting at most timeout_ms for the first datagram
+void receive_for(int timeout_ms) {
+    struct epoll_event events[64];
+    char buffers[UDP_BATCH_SIZE][BUFFER_SIZE];
+    int lengths[UDP_BATCH_SIZE];
+    struct sockaddr_in addresses[UDP_BATCH_SIZE];
+
+    int event_count = epoll_wait(epoll_fd, events, 64, timeout_ms);
+    for (int e = 0; e < event_count; e++) {
+        int client = (int)events[e].data.u32;
+        int rc;
+        while ((rc = udp_socket_read_batch(clients[client].socket_descriptor, addresses, buffers, lengths, UDP_BATCH_SIZE)) > 0) {
+            uint64_t received_ns = now_ns();
+            for (int i = 0; i < rc; i++) {
+                buffers[i][lengths[i]] = '\0';
+                handle_datagram(client, buffers[i], received_ns);
+            }
+        }
+    }
+}
+
+// Send one request of a type drawn from the mix, from a random connected client
+void send_one() {
+    int total = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        total += bench_config.mix[op];
+    }
+    int draw = random_below(total);
+    int op = 0;
+    while (draw >= bench_config.mix[op]) {
+        draw -= bench_config.mix[op];
+        op++;
+    }
+
+    int sender = random_below(bench_config.client_count);
+    if (!clients[sender].connected) {
+        return;
+    }
+    char request[BUFFER_SIZE];
+    int other;
+    switch (op) {
+    case OP_SAY:
+        // Every other connected client should get a copy, except those who muted the sender's current name
+        for (int i = 0; i < bench_config.client_count; i++) {
+            if (i != sender && clients[i].connected && !is_muted(&clients[i], clients[sender].name)) {
+                results.say_expected++;
+            }
+        }
+        snprintf(request, sizeof(request), "say$ B%d:%llu", sender, (unsigned long long)now_ns());
+        break;
+    case OP_SAYTO:
+        if ((other = pick_other_client(sender)) < 0) {
+            return;
+        }
+        snprintf(request, sizeof(request), "sayto$ %s B%d:%llu", clients[other].name, sender, (unsigned long long)now_ns());
+        break;
+    case OP_MUTE:
+        other = pick_other_client(sender);
+        if (other < 0 || clients[sender].mute_count == BENCH_MAX_MUTES || is_muted(&clients[sender], clients[other].name)) {
+            return;
+        }
+        snprintf(clients[sender].muted[clients[sender].mute_count++], BENCH_NAME_LEN, "%s", clients[other].name);
+        snprintf(request, sizeof(request), "mute$ %s", clients[other].name);
+        break;
+    default:
+        // New names are unique, so nobody's mutes apply to the client until they mute the new name
+        snprintf(clients[sender].name, BENCH_NAME_LEN, "b%d_%dr%d", (int)getpid() % 100000, sender, ++clients[sender].renames);
+        snprintf(request, sizeof(request), "rename$ %s", clients[sender].name);
+        break;
+    }
+    send_request(sender, request);
+    results.sent[op]++;
+}
+
+// Open every client's socket and connect it
+// Returns the number of clients the server accepted
+int connect_clients() {
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        return 0;
+    }
+    for (int i = 0; i < bench_config.client_count; i++) {
+        bench_client_t *client = &clients[i];
+        client->socket_descriptor = udp_socket_open(0);
+        int buffer_size = BENCH_SOCKET_BUFFER;
+        setsockopt(client->socket_descriptor, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        fcntl(client->socket_descriptor, F_SETFL, fcntl(client->socket_descriptor, F_GETFL, 0) | O_NONBLOCK);
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->socket_descriptor, &event);
+
+        // The pid keeps names apart from clients a crashed earlier run left on the server
+        snprintf(client->name, BENCH_NAME_LEN, "b%d_%d", (int)getpid() % 100000, i);
+        char request[BUFFER_SIZE];
+        snprintf(request, sizeof(request), "conn$ %s", client->name);
+        send_request(i, request);
+    }
+
+    int connected = 0;
+    uint64_t deadline = now_ns() + CONNECT_TIMEOUT_MS * 1000000ULL;
+    while (connected < bench_config.client_count && now_ns() < deadline) {
+        receive_for(10);
+        connected = 0;
+        for (int i = 0; i < bench_config.client_count; i++) {
+            connected += clients[i].connected;
+        }
+    }
+    // The history each client got on joining is not part of the results
+    receive_for(100);
+    results.datagrams = 0;
+    results.errors = 0;
+    return connected;
+}
+
+// Send requests at the target rate for the configured duration, receiving in between
+void run_load() {
+    uint64_t interval = 1000000000ULL / bench_config.rate;
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)bench_config.duration * 1000000000ULL;
+    uint64_t next_send = start;
+
+    uint64_t now;
+    while ((now = now_ns()) < end) {
+        // Catch up on every request due by now, so a slow receive pass does not lower the rate
+        while (next_send <= now && next_send < end) {
+            send_one();
+            next_send += interval;
+        }
+        int wait_ms = next_send > now ? (int)((next_send - now) / 1000000) : 0;
+        receive_for(wait_ms);
+    }
+
+    uint64_t drain_end = now_ns() + DRAIN_MS * 1000000ULL;
+    while (now_ns() < drain_end) {
+        receive_for(10);
+    }
+}
+
+void disconnect_clients() {
+    for (int i = 0; i < bench_config.client_count; i++) {
+        if (clients[i].connected) {
+            send_request(i, "disconn$");
+        }
+        close(clients[i].socket_descriptor);
+    }
+    close(epoll_fd);
+}
+
+int compare_latency(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Latency (in us) at or below which this fraction of the samples are (latencies must be sorted)
+double latency_percentile_us(double fraction) {
+    if (results.latency_count == 0) {
+        return 0.0;
+    }
+    size_t rank = (size_t)(fraction * (results.latency_count - 1) + 0.5);
+    return results.latencies[rank] / 1000.0;
+}
+
+void print_results(FILE *out, int connected) {
+    qsort(results.latencies, results.latency_count, sizeof(uint64_t), compare_latency);
+    double mean = 0.0;
+    for (size_t i = 0; i < results.latency_count; i++) {
+        mean += results.latencies[i];
+    }
+    mean = results.latency_count > 0 ? mean / results.latency_count / 1000.0 : 0.0;
+
+    unsigned long total_sent = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        total_sent += results.sent[op];
+    }
+    double loss = results.say_expected > 0 && results.say_delivered < results.say_expected ?
+                  (double)(results.say_expected - results.say_delivered) / results.say_expected : 0.0;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"server\": \"%s:%d\",\n", bench_config.server_ip, bench_config.port);
+    fprintf(out, "  \"clients\": %d,\n", bench_config.client_count);
+    fprintf(out, "  \"connected\": %d,\n", connected);
+    fprintf(out, "  \"duration_s\": %d,\n", bench_config.duration);
+    fprintf(out, "  \"target_rate\": %d,\n", bench_config.rate);
+    fprintf(out, "  \"achieved_rate\": %.1f,\n", (double)total_sent / bench_config.duration);
+    fprintf(out, "  \"seed\": %llu,\n", (unsigned long long)bench_config.seed);
+    fprintf(out, "  \"sent\": {");
+    for (int op = 0; op < OP_COUNT; op++) {
+        fprintf(out, "%s\"%s\": %lu", op > 0 ? ", " : "", op_names[op], results.sent[op]);
+    }
+    fprintf(out, "},\n");
+    fprintf(out, "  \"say\": {\"expected\": %lu, \"delivered\": %lu, \"loss\": %.6f, \"delivered_per_s\": %.1f},\n",
+            results.say_expected, results.say_delivered, loss, (double)results.say_delivered / bench_config.duration);
+    fprintf(out, "  \"sayto\": {\"sent\": %lu, \"delivered\": %lu},\n", results.sent[OP_SAYTO], results.sayto_delivered);
+    fprintf(out, "  \"latency_us\": {\"samples\": %zu, \"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f},\n",
+            results.latency_count, mean, latency_percentile_us(0.5), latency_percentile_us(0.9),
+            latency_percentile_us(0.99), latency_percentile_us(0.999), latency_percentile_us(1.0));
+    fprintf(out, "  \"datagrams_received\": %lu,\n", results.datagrams);
+    fprintf(out, "  \"errors\": %lu\n", results.errors);
+    fprintf(out, "}\n");
+}
+
+void print_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [-c clients] [-r rate] [-d seconds] [-m mix] [-s server_ip] [-p port] [-S seed] [-o json_file]\n",
+            program_name);
+    fprintf(stderr, "  -c  simulated clients (default %d)\n", DEFAULT_CLIENTS);
+    fprintf(stderr, "  -r  requests per second over all clients (default %d)\n", DEFAULT_RATE);
+    fprintf(stderr, "  -d  seconds of load (default %d)\n", DEFAULT_DURATION);
+    fprintf(stderr, "  -m  request mix as weights (default %s)\n", DEFAULT_MIX);
+    fprintf(stderr, "  -s  server IP address (default 127.0.0.1)\n");
+    fprintf(stderr, "  -p  server port (default %d)\n", SERVER_PORT);
+    fprintf(stderr, "  -S  random seed, so runs send the same requests (default %d)\n", DEFAULT_SEED);
+    fprintf(stderr, "  -o  write the JSON results to this file instead of stdout\n");
+}
+
+int main(int argc, char *argv[]) {
+    parse_mix(DEFAULT_MIX);
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:d:m:s:p:S:o:")) != -1) {
+        switch (opt) {
+        case 'c':
+            bench_config.client_count = atoi(optarg);
+            break;
+        case 'r':
+            bench_config.rate = atoi(optarg);
+            break;
+        case 'd':
+            bench_config.duration = atoi(optarg);
+            break;
+        case 'm':
+            if (parse_mix(optarg) != 0) {
+                fprintf(stderr, "Invalid mix '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            bench_config.server_ip = optarg;
+            break;
+        case 'p':
+            bench_config.port = atoi(optarg);
+            break;
+        case 'S':
+            bench_config.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            bench_config.output_path = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (bench_config.client_count < 2 || bench_config.rate <= 0 || bench_config.duration <= 0 ||
+        set_socket_addr(&server_address, bench_config.server_ip, bench_config.port) != 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    random_state = bench_config.seed != 0 ? bench_config.seed : DEFAULT_SEED;
+
+    clients = (bench_client_t *)calloc(bench_config.client_count, sizeof(bench_client_t));
+    if (clients == NULL) {
+        fprintf(stderr, "Failed to allocate clients\n");
+        return 1;
+    }
+
+    int connected = connect_clients();
+    fprintf(stderr, "%d of %d clients connected\n", connected, bench_config.client_count);
+    if (connected < 2) {
+        fprintf(stderr, "Not enough clients connected - is the server running on %s:%d?\n", bench_config.server_ip, bench_config.port);
+        return 1;
+    }
+    run_load();
+    disconnect_clients();
+
+    FILE *out = stdout;
+    if (bench_config.output_path != NULL && (out = fopen(bench_config.output_path, "w")) == NULL) {
+        fprintf(stderr, "Failed to open %s\n", bench_config.output_path);
+        return 1;
+    }
+    print_results(out, connected);
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(results.latencies);
+    free(clients);
+    return 0;
+}
@@ -1,6 +1,9 @@
-
+// udp.h uses recvmmsg/sendmmsg, which are GNU extensions
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h> //for strtol
 #include "udp.h"
+#include "chat_wire.h"
 #include <pthread.h>
 #include <string.h>
 #include <ctype.h> //for isspace
@@ -30,6 +33,11 @@ typedef struct{
 
     FILE *chat_write_file; //where we will be storing the output of incoming messages from server
 
+    unsigned long long last_seq; //seq of the newest chat message written to chat_write_file (0 = none yet)
+    FILE *seq_file; //<chat file>.seq, holds last_seq so a later client can resume this chat file with -r
+
+    wire_format_t wire_format; //WIRE_BINARY (-b) sends requests as frames, and the server answers in frames
+
     pthread_mutex_t lock; //Used for locks
 } client_info;
 
@@ -57,6 +65,93 @@ int parse_acknowledge(const char *request, char *command_type, char *content) {
     return 0;
 }
 
+// Note that the chat file now holds every message up to seq (lock must be held)
+// The seq file is rewritten in place, so it always holds one number
+void record_seq(client_info *state, unsigned long long seq) {
+    if (seq <= state->last_seq) {
+        return;
+    }
+    state->last_seq = seq;
+    if (state->seq_file){
+        rewind(state->seq_file);
+        fprintf(state->seq_file, "%20llu\n", seq);
+        fflush(state->seq_file);
+    }
+}
+
+// Strip the "[seq] " that say$ and history$ messages start with, noting the seq
+// Returns the rest of the message (content unchanged if it has no seq)
+const char *take_seq(const char *content, client_info *state) {
+    const char *start = content;
+    while (*start == ' ') {
+        start++;
+    }
+    if (*start != '[') {
+        return content;
+    }
+    char *end;
+    unsigned long long seq = strtoull(start + 1, &end, 10);
+    if (end == start + 1 || *end != ']') {
+        return content;
+    }
+    record_seq(state, seq);
+    return end + 1; //keeps the space before the name, like messages without a seq
+}
+
+// Write the messages of a histpack$ datagram to the chat file
+// content is "<count> <first seq>\n" followed by count records of "<length> <message>" with consecutive seqs
+// Returns 0 on success, -1 if the pack is malformed (messages before the bad record are still written)
+int unpack_history(const char *content, client_info *state) {
+    char *cursor;
+    long count = strtol(content, &cursor, 10);
+    if (cursor == content || *cursor != ' ' || count <= 0) {
+        return -1;
+    }
+    unsigned long long first_seq = strtoull(cursor + 1, &cursor, 10);
+    if (*cursor != '\n') {
+        return -1;
+    }
+    cursor++;
+    const char *end = content + strlen(content);
+
+    pthread_mutex_lock(&state->lock);
+    int rc = 0;
+    for (long i = 0; i < count; i++) {
+        char *message;
+        long length = strtol(cursor, &message, 10);
+        if (message == cursor || *message != ' ' || length < 0 || length > end - (message + 1)) {
+            rc = -1;
+            break;
+        }
+        message++;
+        if (state->chat_write_file){
+            fprintf(state->chat_write_file, " %.*s\n", (int)length, message);
+        }
+        record_seq(state, first_seq + i);
+        cursor = message + length;
+    }
+    if (state->chat_write_file){
+        fflush(state->chat_write_file);
+    }
+    pthread_mutex_unlock(&state->lock);
+    return rc;
+}
+
+// Send a request typed as text ("command$ content"), as a frame in binary mode
+// Returns what udp_socket_write returns, or 0 without sending if the command has no opcode
+int send_request(client_info *state, const char *request, int len) {
+    if (state->wire_format == WIRE_TEXT) {
+        return udp_socket_write(state->socket_descriptor, &state->server_addr, (char *)request, len);
+    }
+    char frame[BUFFER_SIZE];
+    int frame_length = wire_encode_text(frame, sizeof(frame), request, len, 0);
+    if (frame_length < 0) {
+        fprintf(stderr, "Unknown command or request too long: '%.*s'\n", len, request);
+        return 0;
+    }
+    return udp_socket_write(state->socket_descriptor, &state->server_addr, frame, frame_length);
+}
+
 void route_acknowledge(const char*request, void *arg) {
     client_info *state = (client_info *)arg;
     char command_type[BUFFER_SIZE];
@@ -129,10 +224,10 @@ void route_acknowledge(const char*request, void *arg) {
     } else if(strcmp(command_type, "say") == 0){
         pthread_mutex_lock(&state->lock);
         // After checking if file has been successfuly opened
-        // Writes server response to file
+        // Writes server response to file (without its seq)
         // Flusehes file buffer so that the write to file happens instantly    
         if (state->chat_write_file){
-                fprintf(state->chat_write_file, "%s", content);
+                fprintf(state->chat_write_file, "%s", take_seq(content, state));
                 fflush(state->chat_write_file);
             }
         pthread_mutex_unlock(&state->lock);
@@ -154,17 +249,36 @@ void route_acknowledge(const char*request, void *arg) {
         snprintf(ret_ping_msg, BUFFER_SIZE, "ret-ping$\n");
         
         pthread_mutex_lock(&state->lock);
-        udp_socket_write(state->socket_descriptor, &state->server_addr, ret_ping_msg, strlen(ret_ping_msg));
+        send_request(state, ret_ping_msg, strlen(ret_ping_msg));
         pthread_mutex_unlock(&state->lock);
         
         printf("[DEBUG] Responded to server ping\n");
+    } else if(strcmp(command_type, "histpack") == 0) {
+        // Several history messages packed into one datagram
+        if (unpack_history(content, state) != 0) {
+            fprintf(stderr, "Error$ Malformed history from server\n");
+        }
     } else if(strcmp(command_type, "history") == 0) {
         pthread_mutex_lock(&state->lock);
         // After checking if file has been successfuly opened
-        // Writes server response to file
+        // Writes server response to file (without its seq)
         // Flusehes file buffer so that the write to file happens instantly    
         if (state->chat_write_file){
-                fprintf(state->chat_write_file, "%s", content);
+                fprintf(state->chat_write_file, "%s", take_seq(content, state));
+                fflush(state->chat_write_file);
+            }
+        pthread_mutex_unlock(&state->lock);
+    } else if(strcmp(command_type, "join") == 0 || strcmp(command_type, "leave") == 0) {
+        // Room change confirmed (messages from the new room then arrive as say$ and history$)
+        printf("%s", content);
+    } else if(strcmp(command_type, "stats") == 0) {
+        // Server metrics (admin only), one "key=value ..." line per subject
+        printf("%s", content);
+    } else if(strcmp(command_type, "gap") == 0) {
+        // Resumed too late: some messages are gone from the server's history
+        pthread_mutex_lock(&state->lock);
+        if (state->chat_write_file){
+                fprintf(state->chat_write_file, " ...%s", content);
                 fflush(state->chat_write_file);
             }
         pthread_mutex_unlock(&state->lock);
@@ -174,6 +288,66 @@ void route_acknowledge(const char*request, void *arg) {
     }
 }
 
+// Route every frame in a datagram from the server (binary mode)
+// Each frame is turned back into the text message it stands for, so route_acknowledge handles both modes
+void route_frames(const char *datagram, int n, client_info *state) {
+    int offset = 0;
+    while (offset < n) {
+        wire_header_t header;
+        if (wire_decode(datagram + offset, n - offset, &header) != 0) {
+            fprintf(stderr, "Error$ Malformed frame from server\n");
+            return;
+        }
+        const char *payload = datagram + offset + WIRE_HEADER_SIZE;
+        const char *command = wire_command_names[header.opcode];
+        offset += WIRE_HEADER_SIZE + header.length;
+
+        char message[BUFFER_SIZE];
+        if (header.opcode == WIRE_OP_HISTPACK) {
+            //<length><message> records with consecutive seqs, each handled like a history$ message
+            pthread_mutex_lock(&state->lock);
+            unsigned long long seq = wire_widen_seq(header.seq, state->last_seq);
+            pthread_mutex_unlock(&state->lock);
+            const unsigned char *record = (const unsigned char *)payload;
+            const unsigned char *end = record + header.length;
+            while (end - record >= 2 && end - record - 2 >= (record[0] << 8 | record[1])) {
+                int length = record[0] << 8 | record[1];
+                snprintf(message, sizeof(message), "history$ [%llu] %.*s\n", seq++, length, (const char *)record + 2);
+                route_acknowledge(message, state);
+                record += 2 + length;
+            }
+            if (record != end) {
+                fprintf(stderr, "Error$ Malformed history from server\n");
+            }
+            continue;
+        }
+        if (header.seq != 0) {
+            pthread_mutex_lock(&state->lock);
+            unsigned long long seq = wire_widen_seq(header.seq, state->last_seq);
+            pthread_mutex_unlock(&state->lock);
+            snprintf(message, sizeof(message), "%s$ [%llu] %.*s\n", command, seq, (int)header.length, payload);
+        } else {
+            snprintf(message, sizeof(message), "%s$ %.*s\n", command, (int)header.length, payload);
+        }
+
+        //debugging
+        printf("[DEBUG] %s", message);
+        route_acknowledge(message, state);
+    }
+}
+
+// Commands that are sent with nothing after the '$'
+const char *contentless_commands[] = {"disconn", "leave", "stats", NULL};
+
+int is_contentless_command(const char *command, size_t length){
+    for (int i = 0; contentless_commands[i] != NULL; i++){
+        if (strlen(contentless_commands[i]) == length && strncmp(command, contentless_commands[i], length) == 0){
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /// @brief Validates if a client request is in proper format
 /// @param request Input processed request wer are trying to validate
 /// @return 1 if format is valid, else 0
@@ -192,8 +366,8 @@ int validate_request_format(const char *request){
         return 0;
     }
 
-    //check for content after $
-    if (*(dollar_sign + 1) == '\0') {
+    //check for content after $ (except for the commands that take none)
+    if (*(dollar_sign + 1) == '\0' && !is_contentless_command(request, cmd_len)) {
         fprintf(stderr, "Input Error$ No content after $\n");
         return 0;
     }
@@ -265,10 +439,34 @@ void *writer_thread(void *arg)
             }
         }
 
-        //return code
-        //udp_socket_write(int sd, struct sockaddr_in *addr, char *buffer, int n)
-        // rc < 0 is error
-        int rc = udp_socket_write(state->socket_descriptor, &state->server_addr, processed_request, len);
+        //when resuming a chat file, connect with reconn$ so the server only sends what we missed
+        char resume_request[BUFFER_SIZE];
+        pthread_mutex_lock(&state->lock);
+        unsigned long long last_seq = state->last_seq;
+        pthread_mutex_unlock(&state->lock);
+        int rc;
+        if (last_seq > 0 && strncmp(processed_request, "conn$", 5) == 0 && state->wire_format == WIRE_BINARY) {
+            //the frame header carries the seq
+            const char *name = processed_request + 5;
+            while (*name == ' ') {
+                name++;
+            }
+            int n = wire_encode(resume_request, sizeof(resume_request), WIRE_OP_RECONN, (uint32_t)last_seq, name, strlen(name));
+            rc = n < 0 ? -1 : udp_socket_write(state->socket_descriptor, &state->server_addr, resume_request, n);
+        } else {
+            if (last_seq > 0 && strncmp(processed_request, "conn$", 5) == 0) {
+                int n = snprintf(resume_request, sizeof(resume_request), "reconn$ %llu %s", last_seq, processed_request + 5);
+                if (n > 0 && n < (int)sizeof(resume_request)) {
+                    processed_request = resume_request;
+                    len = n;
+                }
+            }
+
+            //return code
+            //udp_socket_write(int sd, struct sockaddr_in *addr, char *buffer, int n)
+            // rc < 0 is error
+            rc = send_request(state, processed_request, len);
+        }
 
         if (rc < 0){
             fprintf(stderr, "udp socket write\n");
@@ -318,7 +516,11 @@ void *listener_thread(void *arg)
         int rc = udp_socket_read(state->socket_descriptor, &responder_addr, server_response, (BUFFER_SIZE-1));
     
         //rc is the number of bytes retrieved
-        if (rc > 0){
+        if (rc > 0 && (unsigned char)server_response[0] == WIRE_VERSION){
+            //binary mode: one or more frames
+            route_frames(server_response, rc, state);
+        }
+        else if (rc > 0){
             server_response[rc] = '\0';
 
             //debugging
@@ -346,8 +548,29 @@ void *listener_thread(void *arg)
 }
 
 // client code
+// Usage: chat_client [-r iChat_<PID>.txt] [-b]
+// -r carries on an earlier client's chat file, fetching only what it missed
+// -b speaks the binary protocol (chat_wire.h) instead of text
 int main(int argc, char *argv[])
 {
+    const char *resume_file = NULL;
+    wire_format_t wire_format = WIRE_TEXT;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:b")) != -1) {
+        if (opt == 'r') {
+            resume_file = optarg;
+        } else if (opt == 'b') {
+            wire_format = WIRE_BINARY;
+        } else {
+            fprintf(stderr, "Usage: %s [-r chat_file] [-b]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc) {
+        fprintf(stderr, "Usage: %s [-r chat_file] [-b]\n", argv[0]);
+        return 1;
+    }
+
     // This function opens a UDP socket,
     // binding it to all IP interfaces of this machine,
     // and port number ANY FREE PORT CHOSEN BY OS (by passing 0).
@@ -365,14 +588,18 @@ int main(int argc, char *argv[])
     state.running = 1;
     state.is_connected = 0;
     state.client_name[0] = '\0';
+    state.last_seq = 0;
+    state.wire_format = wire_format;
 
     pthread_mutex_init(&state.lock, NULL);
+    wire_init_opcode_index(); //for framing requests in binary mode
 
     char chat_file_name[100];
     int pid = getpid();
 
     //append file name to chat_file_name and return the character count
-    int n = snprintf(chat_file_name, sizeof(chat_file_name), "iChat_%d.txt", pid);
+    int n = resume_file != NULL ? snprintf(chat_file_name, sizeof(chat_file_name), "%s", resume_file)
+                                : snprintf(chat_file_name, sizeof(chat_file_name), "iChat_%d.txt", pid);
 
     if (n < 0 || n >= sizeof(chat_file_name)) {
         fprintf(stderr, "[DEBUG] Error creating filename for PID %d\n", pid);
@@ -384,7 +611,8 @@ int main(int argc, char *argv[])
     printf("[DEBUG] tail -f %s\n", chat_file_name);
 
     //fopen iChat.txt, which would be the text file that we store incoming messages
-    state.chat_write_file = fopen(chat_file_name, "w"); //we give it write permission only as file will be read with tail command
+    //a resumed chat file is appended to
+    state.chat_write_file = fopen(chat_file_name, resume_file != NULL ? "a" : "w"); //we give it write permission only as file will be read with tail command
 
     if (!state.chat_write_file){ //fopen fail error
         fprintf(stderr, "fopen error for ichat.txt");
@@ -392,6 +620,19 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    //the seq of the last message in the chat file lives next to it
+    char seq_file_name[128];
+    snprintf(seq_file_name, sizeof(seq_file_name), "%s.seq", chat_file_name);
+    state.seq_file = fopen(seq_file_name, resume_file != NULL ? "r+" : "w");
+    if (state.seq_file && resume_file != NULL) {
+        if (fscanf(state.seq_file, "%llu", &state.last_seq) != 1) {
+            state.last_seq = 0;
+        }
+        printf("[DEBUG] Resuming %s after message %llu\n", chat_file_name, state.last_seq);
+    } else if (!state.seq_file && resume_file != NULL) {
+        state.seq_file = fopen(seq_file_name, "w");
+    }
+
     // Initializing the server's address.
     // We are currently running the server on localhost (127.0.0.1).
     // You can change this to a different IP address
@@ -435,6 +676,9 @@ int main(int argc, char *argv[])
     pthread_mutex_lock(&state.lock);
     //close ichat.txt
     fclose(state.chat_write_file);
+    if (state.seq_file) {
+        fclose(state.seq_file);
+    }
     pthread_mutex_unlock(&state.lock);
 
     pthread_mutex_destroy(&state.lock);
@@ -0,0 +1,192 @@
+// Asynchronous leveled logging
+// A thread formats each line into its own ring (single producer: that thread, single consumer: the drain
+// thread), and a background thread copies every ring into the log file. Logging threads never share a lock
+// or write to the file themselves, so logging is not a point where they all queue up behind each other.
+//
+// Lines below the current level are skipped before their arguments are even evaluated (see LOG_DEBUG),
+// so disabled debug logging costs one relaxed load. A thread whose ring is full drops the line and counts it.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#define LOG_RING_SLOTS 256 // Lines a thread can have waiting for the drain thread (power of two)
+#define LOG_LINE_MAX 256   // Longer lines are cut
+#define LOG_DRAIN_INTERVAL_MS 10 // Drain thread sleep when every ring is empty
+
+typedef enum {
+    LOG_LEVEL_NONE,
+    LOG_LEVEL_INFO,  // Startup and monitor reports
+    LOG_LEVEL_DEBUG, // Every request
+    LOG_LEVEL_COUNT
+} log_level_t;
+
+const char *log_level_names[LOG_LEVEL_COUNT] = {"none", "info", "debug"};
+const char *log_level_tags[LOG_LEVEL_COUNT] = {"", "[INFO] ", "[DEBUG] "};
+
+typedef struct {
+    uint16_t length;
+    char text[LOG_LINE_MAX];
+} log_line_t;
+
+// One per thread that has ever logged
+// head and tail sit on their own cache lines, so the owner and the drain thread do not bounce one line between them
+typedef struct log_ring {
+    _Alignas(64) atomic_uint_fast32_t head; // Next slot the owner fills (only the owner stores it)
+    _Alignas(64) atomic_uint_fast32_t tail; // Next slot the drain thread writes out (only the drain thread stores it)
+    atomic_ulong dropped;                   // Lines lost because the ring was full
+    struct log_ring *next;
+    log_line_t lines[LOG_RING_SLOTS];
+} log_ring_t;
+
+typedef struct {
+    atomic_int level;
+    _Atomic(log_ring_t *) rings; // Every registered ring; only ever pushed onto, so the drain thread walks it without a lock
+    FILE *file;
+    pthread_t drain_tid;
+    int started;
+    atomic_int stopping; // Set by log_stop: the drain thread writes out what is left and exits
+} log_domain_t;
+
+log_domain_t log_domain = {.level = LOG_LEVEL_INFO};
+__thread log_ring_t *log_self;
+
+// Whether lines at this level are currently written
+static inline int log_enabled(log_level_t level) {
+    return atomic_load_explicit(&log_domain.level, memory_order_relaxed) >= (int)level;
+}
+
+// Change the level (any thread, any time)
+void log_set_level(log_level_t level) {
+    atomic_store_explicit(&log_domain.level, level, memory_order_relaxed);
+}
+
+// Level for a name in log_level_names, -1 if there is none
+int log_level_for(const char *name) {
+    for (int level = 0; level < LOG_LEVEL_COUNT; level++) {
+        if (strcmp(log_level_names[level], name) == 0) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+// This thread's ring, registered on first use
+log_ring_t *log_thread_ring() {
+    if (log_self != NULL) {
+        return log_self;
+    }
+    log_ring_t *ring;
+    if (posix_memalign((void **)&ring, 64, sizeof(log_ring_t)) != 0) {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(log_ring_t));
+    ring->next = atomic_load(&log_domain.rings);
+    while (!atomic_compare_exchange_weak(&log_domain.rings, &ring->next, ring)) {
+    }
+    log_self = ring;
+    return ring;
+}
+
+// Format a line into this thread's ring (use the LOG_* macros, which check the level first)
+void log_write(log_level_t level, const char *format, ...) {
+    log_ring_t *ring = log_thread_ring();
+    if (ring == NULL) {
+        return;
+    }
+    uint_fast32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    // One byte is kept back for the newline, added if the line does not end with one
+    log_line_t *line = &ring->lines[head & (LOG_RING_SLOTS - 1)];
+    int capacity = LOG_LINE_MAX - 1;
+    int n = snprintf(line->text, capacity, "%s", log_level_tags[level]);
+    va_list args;
+    va_start(args, format);
+    n += vsnprintf(line->text + n, capacity - n, format, args);
+    va_end(args);
+    if (n > capacity - 1) {
+        n = capacity - 1;
+    }
+    if (n == 0 || line->text[n - 1] != '\n') {
+        line->text[n++] = '\n';
+    }
+    line->length = n;
+
+    // Publishes the line: the drain thread reads it only after seeing the new head
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+#define LOG_INFO(...) do { if (log_enabled(LOG_LEVEL_INFO)) log_write(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+#define LOG_DEBUG(...) do { if (log_enabled(LOG_LEVEL_DEBUG)) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+
+// Write out everything waiting in every ring
+// Returns the number of lines written
+size_t log_drain() {
+    size_t written = 0;
+    for (log_ring_t *ring = atomic_load(&log_domain.rings); ring != NULL; ring = ring->next) {
+        uint_fast32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint_fast32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            log_line_t *line = &ring->lines[tail & (LOG_RING_SLOTS - 1)];
+            fwrite(line->text, 1, line->length, log_domain.file);
+            written++;
+        }
+        // Hands the slots back to the owner
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        unsigned long dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+        if (dropped > 0) {
+            fprintf(log_domain.file, "[INFO] Log ring full, %lu line(s) dropped\n", dropped);
+            written++;
+        }
+    }
+    if (written > 0) {
+        fflush(log_domain.file);
+    }
+    return written;
+}
+
+void *log_drain_thread(void *arg) {
+    (void)arg;
+    struct timespec interval = {0, LOG_DRAIN_INTERVAL_MS * 1000000L};
+    while (!atomic_load_explicit(&log_domain.stopping, memory_order_acquire)) {
+        if (log_drain() == 0) {
+            nanosleep(&interval, NULL);
+        }
+    }
+    return NULL;
+}
+
+// Start writing logged lines to file (lines logged before this are kept and written then)
+// Returns 0 on success, -1 if the drain thread could not be started
+int log_start(FILE *file) {
+    log_domain.file = file;
+    if (pthread_create(&log_domain.drain_tid, NULL, log_drain_thread, NULL) != 0) {
+        return -1;
+    }
+    log_domain.started = 1;
+    return 0;
+}
+
+// Stop the drain thread and write out every line logged before this call (call once, at shutdown,
+// after the threads that log have finished). The file stays open: it belongs to whoever passed it to log_start
+void log_stop() {
+    if (!log_domain.started) {
+        return;
+    }
+    atomic_store_explicit(&log_domain.stopping, 1, memory_order_release);
+    pthread_join(log_domain.drain_tid, NULL);
+    log_domain.started = 0;
+
+    // The drain thread is gone, so this thread is now the only one reading the rings
+    log_drain();
+    fflush(log_domain.file);
+}
@@ -0,0 +1,765 @@
+// Microbenchmarks for the server's data structures, linked straight into the server source (no sockets)
+// Two suites:
+//   layout: the original client list layout (a linked list of nodes with the 256-byte name stored ahead of the
+//           fields the walks need) against the hot/cold split in chat_server.c, for the walks the server makes
+//           over every client and for finding one client
+//   ops:    the core routines (adding, finding and removing clients, mutes, history, request parsing) run from
+//           several threads at once, reporting ns per operation and how often the shared locks made a thread wait
+//
+// Build: gcc -O2 chat_microbench.c -o chat_microbench
+// Run:   ./chat_microbench [-s layout|ops] [-t threads[,threads...]] [client_count ...]
+//        (default both suites, 1,4,16,64 threads, 10 100 1000 10000 100000 clients)
+
+#define CHAT_SERVER_NO_MAIN
+#include "chat_server.c"
+
+#define DEFAULT_POPULATIONS {10, 100, 1000, 10000, 100000}
+#define WALK_CLIENT_VISITS 50000000L  // Clients visited per walk benchmark (split into repeated walks)
+#define LOOKUP_CLIENT_VISITS 200000000L // Clients visited per linear lookup benchmark
+#define LOOKUP_COUNT 200000           // Lookups per indexed lookup benchmark
+
+// The client node and mute node as they were before the hot/cold split
+typedef struct legacy_muted_node {
+    char muted_name[MAX_NAME_LEN];
+    struct legacy_muted_node *next;
+} legacy_muted_node_t;
+
+typedef struct legacy_client_node {
+    char client_name[MAX_NAME_LEN];
+    struct sockaddr_in client_address;
+    struct legacy_client_node *next;
+    time_t last_active_time;
+    int is_admin;
+    legacy_muted_node_t *muted_head;
+} legacy_client_node_t;
+
+legacy_client_node_t *legacy_head;
+
+// Results go here; the server's own [DEBUG] output goes to /dev/null
+FILE *bench_out;
+volatile long bench_sink;
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void client_address_for(int i, struct sockaddr_in *address) {
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_addr.s_addr = htonl(0x0a000000 + (i >> 16)); // 10.0.x.x
+    address->sin_port = htons(1024 + (i & 0xffff));
+}
+
+void destroy_clients() {
+    client_list_write_lock();
+    while (client_list.count > 0) {
+        remove_client_node_locked(client_list.nodes[client_list.count - 1]);
+    }
+    client_list_unlock();
+}
+
+void build_populations(int count) {
+    legacy_head = NULL;
+    time_t start = coarse_now();
+    for (int i = 0; i < count; i++) {
+        char name[32];
+        struct sockaddr_in address;
+        snprintf(name, sizeof(name), "user%d", i);
+        client_address_for(i, &address);
+
+        legacy_client_node_t *node = (legacy_client_node_t *)malloc(sizeof(legacy_client_node_t));
+        strncpy(node->client_name, name, MAX_NAME_LEN - 1);
+        node->client_name[MAX_NAME_LEN - 1] = '\0';
+        node->client_address = address;
+        node->last_active_time = start;
+        node->is_admin = 0;
+        node->muted_head = NULL;
+        node->next = legacy_head;
+        legacy_head = node;
+
+        if (add_client(name, &address, 0, WIRE_TEXT) == NULL) {
+            fprintf(stderr, "add_client failed at %d\n", i);
+            exit(1);
+        }
+    }
+}
+
+void destroy_populations() {
+    while (legacy_head != NULL) {
+        legacy_client_node_t *next = legacy_head->next;
+        free(legacy_head);
+        legacy_head = next;
+    }
+    destroy_clients();
+}
+
+// --- Broadcast: collect every recipient's address, skipping the sender and their muters ---
+
+int legacy_is_muted(legacy_client_node_t *client, const char *muted_name) {
+    for (legacy_muted_node_t *m = client->muted_head; m != NULL; m = m->next) {
+        if (strcmp(m->muted_name, muted_name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void legacy_broadcast_walk(struct sockaddr_in *skip_address, const char *muted_sender) {
+    broadcast_targets_t *targets = &broadcast_targets[WIRE_TEXT];
+    targets->count = 0;
+    for (legacy_client_node_t *current = legacy_head; current != NULL; current = current->next) {
+        if (same_address(&current->client_address, skip_address)) {
+            continue;
+        }
+        if (legacy_is_muted(current, muted_sender)) {
+            continue;
+        }
+        add_broadcast_target(targets, &current->client_address);
+    }
+    bench_sink += targets->count;
+}
+
+void hot_broadcast_walk(struct sockaddr_in *skip_address, const char *muted_sender) {
+    epoch_enter();
+    collect_broadcast_targets(broadcast_targets, skip_address, muted_sender);
+    epoch_exit();
+    bench_sink += broadcast_targets[WIRE_TEXT].count;
+}
+
+// --- Inactivity check: find every client idle past the threshold ---
+
+void legacy_inactivity_walk(time_t current_time) {
+    long inactive = 0;
+    for (legacy_client_node_t *current = legacy_head; current != NULL; current = current->next) {
+        if (current_time - current->last_active_time >= INACTIVITY_THRESHOLD) {
+            inactive++;
+        }
+    }
+    bench_sink += inactive;
+}
+
+void hot_inactivity_walk(time_t current_time) {
+    long inactive = 0;
+    for (uint32_t i = 0; i < client_list.count; i++) {
+        if (current_time - atomic_load_explicit(&client_list.hot[i].last_active_time, memory_order_relaxed) >= INACTIVITY_THRESHOLD) {
+            inactive++;
+        }
+    }
+    bench_sink += inactive;
+}
+
+// --- Lookups: find the sender of a request and mark them active, or find a client by name ---
+
+void legacy_touch_by_address(struct sockaddr_in *address, time_t current_time) {
+    for (legacy_client_node_t *current = legacy_head; current != NULL; current = current->next) {
+        if (same_address(&current->client_address, address)) {
+            current->last_active_time = current_time;
+            return;
+        }
+    }
+}
+
+void hot_touch_by_address(struct sockaddr_in *address, time_t current_time) {
+    client_node_t *client = find_client_by_address_locked(address);
+    if (client != NULL) {
+        atomic_store_explicit(&client_list.hot[client->hot_index].last_active_time, current_time, memory_order_relaxed);
+    }
+}
+
+legacy_client_node_t *legacy_find_by_name(const char *name) {
+    for (legacy_client_node_t *current = legacy_head; current != NULL; current = current->next) {
+        if (strcmp(current->client_name, name) == 0) {
+            return current;
+        }
+    }
+    return NULL;
+}
+
+void report(const char *benchmark, int clients, double legacy_ns, double hot_ns) {
+    fprintf(bench_out, "%-22s %8d %16.1f %16.1f %9.2fx\n", benchmark, clients, legacy_ns, hot_ns, legacy_ns / hot_ns);
+}
+
+void run_population(int count) {
+    build_populations(count);
+
+    struct sockaddr_in sender;
+    client_address_for(count / 2, &sender);
+    time_t current_time = coarse_now();
+
+    // Walks: time per walk over all clients
+    long walks = WALK_CLIENT_VISITS / count;
+    if (walks < 3) {
+        walks = 3;
+    }
+
+    double start = now_ns();
+    for (long i = 0; i < walks; i++) {
+        legacy_broadcast_walk(&sender, "user0");
+    }
+    double legacy_ns = (now_ns() - start) / walks;
+    start = now_ns();
+    for (long i = 0; i < walks; i++) {
+        hot_broadcast_walk(&sender, "user0");
+    }
+    double hot_ns = (now_ns() - start) / walks;
+    report("broadcast walk", count, legacy_ns, hot_ns);
+
+    start = now_ns();
+    for (long i = 0; i < walks; i++) {
+        legacy_inactivity_walk(current_time);
+    }
+    legacy_ns = (now_ns() - start) / walks;
+    start = now_ns();
+    for (long i = 0; i < walks; i++) {
+        hot_inactivity_walk(current_time);
+    }
+    hot_ns = (now_ns() - start) / walks;
+    report("inactivity walk", count, legacy_ns, hot_ns);
+
+    // Lookups: time per lookup of a random client (the legacy list gets fewer lookups, it is O(n))
+    long legacy_lookups = LOOKUP_CLIENT_VISITS / count;
+    if (legacy_lookups > LOOKUP_COUNT) {
+        legacy_lookups = LOOKUP_COUNT;
+    }
+    if (legacy_lookups < 10) {
+        legacy_lookups = 10;
+    }
+    unsigned int seed = 12345;
+    struct sockaddr_in address;
+
+    start = now_ns();
+    for (long i = 0; i < legacy_lookups; i++) {
+        client_address_for(rand_r(&seed) % count, &address);
+        legacy_touch_by_address(&address, current_time);
+    }
+    legacy_ns = (now_ns() - start) / legacy_lookups;
+    start = now_ns();
+    for (long i = 0; i < LOOKUP_COUNT; i++) {
+        client_address_for(rand_r(&seed) % count, &address);
+        hot_touch_by_address(&address, current_time);
+    }
+    hot_ns = (now_ns() - start) / LOOKUP_COUNT;
+    report("lookup by address", count, legacy_ns, hot_ns);
+
+    char name[32];
+    start = now_ns();
+    for (long i = 0; i < legacy_lookups; i++) {
+        snprintf(name, sizeof(name), "user%d", rand_r(&seed) % count);
+        bench_sink += legacy_find_by_name(name) != NULL;
+    }
+    legacy_ns = (now_ns() - start) / legacy_lookups;
+    start = now_ns();
+    for (long i = 0; i < LOOKUP_COUNT; i++) {
+        snprintf(name, sizeof(name), "user%d", rand_r(&seed) % count);
+        bench_sink += find_client_by_name_locked(view_of(name)) != NULL;
+    }
+    hot_ns = (now_ns() - start) / LOOKUP_COUNT;
+    report("lookup by name", count, legacy_ns, hot_ns);
+
+    destroy_populations();
+}
+
+// --- Operations suite: the server's core routines, from several threads at once ---
+
+#define DEFAULT_THREAD_COUNTS {1, 4, 16, 64}
+#define MAX_THREADS 64
+#define RUN_MS 200           // Each benchmark runs this long for every population and thread count
+#define OP_BATCH 32          // Operations timed together; their inputs are prepared, untimed, before each batch
+#define CHURN_BASE (1 << 24) // Clients added by the churn benchmarks get indexes from here, clear of the population
+
+typedef struct {
+    pthread_t tid;
+    int index;
+    unsigned int seed;
+    long ops;          // Operations done in the current run
+    double elapsed_ns; // Time spent in timed batches in the current run
+    long sink;         // Results, so the work is not optimised away (added to bench_sink after the run)
+} bench_thread_t;
+
+typedef struct {
+    const char *name;
+    void (*run)(bench_thread_t *thread); // Does batches of operations until bench_stop is set
+    int uses_population;                 // 0 = the population makes no difference, so it runs once
+} op_benchmark_t;
+
+// The threads are started once and reused for every run, so thread-local state (stats blocks, slab caches,
+// epoch records) is set up once, as it is for the server's workers
+bench_thread_t bench_threads[MAX_THREADS];
+int pool_size;      // Threads started (the largest thread count asked for)
+int active_threads; // Threads taking part in the current run
+const op_benchmark_t *current_benchmark; // NULL tells the pool to exit
+atomic_int bench_stop;
+pthread_barrier_t run_start;
+pthread_barrier_t run_end;
+
+// Clients of the current population ("user<i>" at client_address_for(i)); the history keeps as many messages
+int population;
+client_node_t **population_nodes;
+int *population_mutes; // The client each client has muted
+
+int bench_running() {
+    return !atomic_load_explicit(&bench_stop, memory_order_relaxed);
+}
+
+// add_client and remove_client_by_address: a thread adds a batch of new clients and removes them again, so the
+// population stays the same size; time_adds picks which half is timed
+void churn(bench_thread_t *thread, int time_adds) {
+    char names[OP_BATCH][32];
+    struct sockaddr_in addresses[OP_BATCH];
+    for (int i = 0; i < OP_BATCH; i++) {
+        snprintf(names[i], sizeof(names[i]), "churn%d_%d", thread->index, i);
+        client_address_for(CHURN_BASE + thread->index * OP_BATCH + i, &addresses[i]);
+    }
+    while (bench_running()) {
+        double start = now_ns();
+        for (int i = 0; i < OP_BATCH; i++) {
+            if (add_client(names[i], &addresses[i], 0, WIRE_TEXT) == NULL) {
+                fprintf(stderr, "add_client failed for %s\n", names[i]);
+                exit(1);
+            }
+        }
+        double added = now_ns();
+        for (int i = 0; i < OP_BATCH; i++) {
+            thread->sink += remove_client_by_address(&addresses[i]);
+        }
+        thread->elapsed_ns += time_adds ? added - start : now_ns() - added;
+        thread->ops += OP_BATCH;
+    }
+}
+
+void bench_add_client(bench_thread_t *thread) {
+    churn(thread, 1);
+}
+
+void bench_remove_client(bench_thread_t *thread) {
+    churn(thread, 0);
+}
+
+void bench_find_by_name(bench_thread_t *thread) {
+    char names[OP_BATCH][32];
+    while (bench_running()) {
+        for (int i = 0; i < OP_BATCH; i++) {
+            snprintf(names[i], sizeof(names[i]), "user%d", rand_r(&thread->seed) % population);
+        }
+        double start = now_ns();
+        for (int i = 0; i < OP_BATCH; i++) {
+            thread->sink += find_client_by_name(view_of(names[i])) != NULL;
+        }
+        thread->elapsed_ns += now_ns() - start;
+        thread->ops += OP_BATCH;
+    }
+}
+
+void bench_find_by_address(bench_thread_t *thread) {
+    struct sockaddr_in addresses[OP_BATCH];
+    while (bench_running()) {
+        for (int i = 0; i < OP_BATCH; i++) {
+            client_address_for(rand_r(&thread->seed) % population, &addresses[i]);
+        }
+        double start = now_ns();
+        for (int i = 0; i < OP_BATCH; i++) {
+            thread->sink += find_client_by_address(&addresses[i]) != NULL;
+        }
+        thread->elapsed_ns += now_ns() - start;
+        thread->ops += OP_BATCH;
+    }
+}
+
+// Random (client, muted name) pairs; every other name is one the client has muted
+void pick_mutes(bench_thread_t *thread, client_node_t **clients, char (*names)[32]) {
+    for (int i = 0; i < OP_BATCH; i++) {
+        int client = rand_r(&thread->seed) % population;
+        int muted = (i & 1) ? population_mutes[client] : (int)(rand_r(&thread->seed) % population);
+        clients[i] = population_nodes[client];
+        snprintf(names[i], 32, "user%d", muted);
+    }
+}
+
+// add_muted_client as mute$ runs it, in a write section of its own; the new mutes are taken back, untimed,
+// after each batch (the write section that publishes that costs as much again, and is not counted)
+void bench_add_muted(bench_thread_t *thread) {
+    client_node_t *clients[OP_BATCH];
+    char names[OP_BATCH][32];
+    int added[OP_BATCH];
+    while (bench_running()) {
+        pick_mutes(thread, clients, names);
+        double start = now_ns();
+        for (int i = 0; i < OP_BATCH; i++) {
+            client_list_write_lock();
+            added[i] = add_muted_client(clients[i], view_of(names[i])) == 0;
+            client_list_unlock();
+        }
+        thread->elapsed_ns += now_ns() - start;
+        thread->ops += OP_BATCH;
+
+        client_list_write_lock();
+        for (int i = 0; i < OP_BATCH; i++) {
+            if (added[i]) {
+                remove_muted_client(clients[i], view_of(names[i]));
+            }
+        }
+        client_list_unlock();
+    }
+}
+
+void bench_is_muted(bench_thread_t *thread) {
+    client_node_t *clients[OP_BATCH];
+    char names[OP_BATCH][32];
+    while (bench_running()) {
+        pick_mutes(thread, clients, names);
+        double start = now_ns();
+        for (int i = 0; i < OP_BATCH; i++) {
+            client_list_read_lock();
+            thread->sink += is_client_muted_locked(clients[i], view_of(names[i]));
+            client_list_unlock();
+        }
+        thread->elapsed_ns += now_ns() - start;
+        thread->ops += OP_BATCH;
+    }
+}
+
+void bench_add_to_history(bench_thread_t *thread) {
+    char message[64];
+    int length = snprintf(message, sizeof(message), "user%d: a message of about the usual length", thread->index);
+    while (bench_running()) {
+        double start = now_ns();
+        for (int i = 0; i < OP_BATCH; i++) {
+            thread->sink += add_to_history(&chat_history, message, length) != 0;
+        }
+        thread->elapsed_ns += now_ns() - start;
+        thread->ops += OP_BATCH;
+    }
+}
+
+// One operation reads every kept message in place, as send_history does for a joining client
+void bench_read_history(bench_thread_t *thread) {
+    while (bench_running()) {
+        double start = now_ns();
+        for (int i = 0; i < OP_BATCH; i++) {
+            history_cursor_t cursor;
+            history_span_t span;
+            epoch_enter();
+            history_cursor_open(&chat_history, &cursor, 0);
+            while (history_cursor_next(&cursor, &span)) {
+                thread->sink += span.length;
+            }
+            epoch_exit();
+        }
+        thread->elapsed_ns += now_ns() - start;
+        thread->ops += OP_BATCH;
+    }
+}
+
+// The parsing benchmarks read their input through a volatile pointer, so the compiler cannot work the
+// results out once and reuse them
+str_view_t sample_requests[4];
+str_view_t sample_contents[4];
+
+void bench_parse_request(bench_thread_t *thread) {
+    str_view_t *volatile requests = sample_requests;
+    str_view_t command_type, content;
+    while (bench_running()) {
+        double start = now_ns();
+        for (int i = 0; i < OP_BATCH; i++) {
+            if (parse_request(requests[i & 3], &command_type, &content) == 0) {
+                thread->sink += command_type.length + content.length;
+            }
+        }
+        thread->elapsed_ns += now_ns() - start;
+        thread->ops += OP_BATCH;
+    }
+}
+
+void bench_view_trim(bench_thread_t *thread) {
+    str_view_t *volatile contents = sample_contents;
+    while (bench_running()) {
+        double start = now_ns();
+        for (int i = 0; i < OP_BATCH; i++) {
+            thread->sink += view_trim(contents[i & 3]).length;
+        }
+        thread->elapsed_ns += now_ns() - start;
+        thread->ops += OP_BATCH;
+    }
+}
+
+const op_benchmark_t op_benchmarks[] = {
+    {"add_client", bench_add_client, 1},
+    {"remove_client_by_address", bench_remove_client, 1},
+    {"find_client_by_name", bench_find_by_name, 1},
+    {"find_client_by_address", bench_find_by_address, 1},
+    {"add_muted_client", bench_add_muted, 1},
+    {"is_client_muted_locked", bench_is_muted, 1},
+    {"add_to_history", bench_add_to_history, 1},
+    {"read_history", bench_read_history, 1},
+    {"parse_request", bench_parse_request, 0},
+    {"view_trim", bench_view_trim, 0},
+};
+
+void *pool_thread(void *arg) {
+    bench_thread_t *thread = (bench_thread_t *)arg;
+    while (1) {
+        pthread_barrier_wait(&run_start);
+        if (current_benchmark == NULL) {
+            return NULL;
+        }
+        if (thread->index < active_threads) {
+            current_benchmark->run(thread);
+        }
+        pthread_barrier_wait(&run_end);
+    }
+}
+
+void start_pool(int size) {
+    pool_size = size;
+    pthread_barrier_init(&run_start, NULL, size + 1);
+    pthread_barrier_init(&run_end, NULL, size + 1);
+    for (int t = 0; t < size; t++) {
+        bench_threads[t].index = t;
+        bench_threads[t].seed = 12345 + t;
+        if (pthread_create(&bench_threads[t].tid, NULL, pool_thread, &bench_threads[t]) != 0) {
+            fprintf(stderr, "Failed to start benchmark thread %d\n", t);
+            exit(1);
+        }
+    }
+}
+
+void stop_pool() {
+    current_benchmark = NULL;
+    pthread_barrier_wait(&run_start);
+    for (int t = 0; t < pool_size; t++) {
+        pthread_join(bench_threads[t].tid, NULL);
+    }
+    pthread_barrier_destroy(&run_start);
+    pthread_barrier_destroy(&run_end);
+}
+
+// Run one benchmark on threads threads for RUN_MS and report it
+// Lock figures are the difference in the server's lock counters (chat_stats.h) over the run, for all locks together,
+// so they include the untimed halves of the churn and mute benchmarks
+void run_op_benchmark(const op_benchmark_t *benchmark, int threads) {
+    stats_counters_t *before = (stats_counters_t *)malloc(sizeof(stats_counters_t));
+    stats_counters_t *after = (stats_counters_t *)malloc(sizeof(stats_counters_t));
+    if (before == NULL || after == NULL) {
+        fprintf(stderr, "Failed to allocate stats\n");
+        exit(1);
+    }
+    for (int t = 0; t < threads; t++) {
+        bench_threads[t].ops = 0;
+        bench_threads[t].elapsed_ns = 0;
+    }
+    stats_collect(before);
+
+    current_benchmark = benchmark;
+    active_threads = threads;
+    atomic_store(&bench_stop, 0);
+    pthread_barrier_wait(&run_start);
+    double start = now_ns();
+    usleep(RUN_MS * 1000);
+    atomic_store(&bench_stop, 1);
+    pthread_barrier_wait(&run_end);
+    double wall_ns = now_ns() - start;
+
+    stats_collect(after);
+    long ops = 0;
+    double elapsed_ns = 0;
+    for (int t = 0; t < threads; t++) {
+        ops += bench_threads[t].ops;
+        elapsed_ns += bench_threads[t].elapsed_ns;
+        bench_sink += bench_threads[t].sink;
+    }
+    uint64_t acquisitions = 0, contended = 0, wait_ns = 0;
+    for (int lock = 0; lock < STATS_LOCK_COUNT; lock++) {
+        acquisitions += after->lock_acquisitions[lock] - before->lock_acquisitions[lock];
+        contended += after->lock_contended[lock] - before->lock_contended[lock];
+        wait_ns += after->lock_wait_ns[lock] - before->lock_wait_ns[lock];
+    }
+
+    char clients[16];
+    snprintf(clients, sizeof(clients), benchmark->uses_population ? "%d" : "-", population);
+    fprintf(bench_out, "%-26s %8s %7d %12.1f %9.2f %9.2f %11.2f %12.1f\n", benchmark->name, clients, threads,
+            ops > 0 ? elapsed_ns / ops : 0.0, ops / wall_ns * 1e3, ops > 0 ? (double)acquisitions / ops : 0.0,
+            acquisitions > 0 ? 100.0 * contended / acquisitions : 0.0, ops > 0 ? (double)wait_ns / ops : 0.0);
+    fflush(bench_out);
+    free(before);
+    free(after);
+
+    // Clients added by the churn benchmarks leave their inactivity timers behind
+    destroy_timer_wheel();
+    init_timer_wheel();
+}
+
+// Add count clients, each muting one other client, and fill the history with count messages
+void build_ops_population(int count) {
+    population = count;
+    population_nodes = (client_node_t **)malloc(sizeof(client_node_t *) * count);
+    population_mutes = (int *)malloc(sizeof(int) * count);
+    if (population_nodes == NULL || population_mutes == NULL) {
+        fprintf(stderr, "Failed to allocate population\n");
+        exit(1);
+    }
+    unsigned int seed = 54321;
+    char name[32];
+    for (int i = 0; i < count; i++) {
+        struct sockaddr_in address;
+        snprintf(name, sizeof(name), "user%d", i);
+        client_address_for(i, &address);
+        population_nodes[i] = add_client(name, &address, 0, WIRE_TEXT);
+        if (population_nodes[i] == NULL) {
+            fprintf(stderr, "add_client failed at %d\n", i);
+            exit(1);
+        }
+    }
+    // One write section, so the mute table is rebuilt once rather than per mute
+    client_list_write_lock();
+    for (int i = 0; i < count; i++) {
+        population_mutes[i] = count > 1 ? (i + 1 + rand_r(&seed) % (count - 1)) % count : i;
+        snprintf(name, sizeof(name), "user%d", population_mutes[i]);
+        add_muted_client(population_nodes[i], view_of(name));
+    }
+    client_list_unlock();
+
+    chat_history.depth = count;
+    for (int i = 0; i < count; i++) {
+        int length = snprintf(name, sizeof(name), "user%d: hello", i);
+        add_to_history(&chat_history, name, length);
+    }
+}
+
+void destroy_ops_population() {
+    destroy_clients();
+    free(population_nodes);
+    free(population_mutes);
+    population_nodes = NULL;
+    population_mutes = NULL;
+}
+
+void run_ops_population(int count, int first, const int *thread_counts, int thread_count_count) {
+    build_ops_population(count);
+    for (size_t b = 0; b < sizeof(op_benchmarks) / sizeof(op_benchmarks[0]); b++) {
+        if (!op_benchmarks[b].uses_population && !first) {
+            continue;
+        }
+        for (int t = 0; t < thread_count_count; t++) {
+            run_op_benchmark(&op_benchmarks[b], thread_counts[t]);
+        }
+    }
+    destroy_ops_population();
+}
+
+void print_bench_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [-s layout|ops] [-t threads[,threads...]] [client_count ...]\n", program_name);
+    fprintf(stderr, "  -s  run one suite only (default both)\n");
+    fprintf(stderr, "  -t  thread counts for the ops suite, 1 to %d (default 1,4,16,64)\n", MAX_THREADS);
+}
+
+int main(int argc, char *argv[]) {
+    int run_layout = 1;
+    int run_ops = 1;
+    int default_thread_counts[] = DEFAULT_THREAD_COUNTS;
+    int thread_counts[MAX_THREADS];
+    int thread_count_count = (int)(sizeof(default_thread_counts) / sizeof(default_thread_counts[0]));
+    memcpy(thread_counts, default_thread_counts, sizeof(default_thread_counts));
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:")) != -1) {
+        switch (opt) {
+        case 's':
+            run_layout = strcmp(optarg, "layout") == 0;
+            run_ops = strcmp(optarg, "ops") == 0;
+            if (!run_layout && !run_ops) {
+                print_bench_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            thread_count_count = 0;
+            for (char *item = strtok(optarg, ","); item != NULL; item = strtok(NULL, ",")) {
+                int threads = atoi(item);
+                if (threads < 1 || threads > MAX_THREADS || thread_count_count == MAX_THREADS) {
+                    fprintf(stderr, "Invalid thread count '%s'\n", item);
+                    return 1;
+                }
+                thread_counts[thread_count_count++] = threads;
+            }
+            if (thread_count_count == 0) {
+                print_bench_usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            print_bench_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    bench_out = fdopen(dup(STDOUT_FILENO), "w");
+    if (bench_out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "Failed to redirect server output\n");
+        return 1;
+    }
+
+    int default_populations[] = DEFAULT_POPULATIONS;
+    int given_populations = argc - optind;
+    int population_count = given_populations > 0 ? given_populations : (int)(sizeof(default_populations) / sizeof(default_populations[0]));
+    int populations[population_count];
+    for (int i = 0; i < population_count; i++) {
+        populations[i] = given_populations > 0 ? atoi(argv[optind + i]) : default_populations[i];
+        if (populations[i] <= 0) {
+            fprintf(stderr, "Invalid client count '%s'\n", argv[optind + i]);
+            return 1;
+        }
+    }
+
+    refresh_coarse_clock();
+    init_slabs();
+    init_client_list();
+    init_history(&chat_history, server_config.history_depth);
+    init_timer_wheel();
+
+    if (run_layout) {
+        fprintf(bench_out, "client_node_t %zu bytes (was %zu), client_hot_t %zu bytes\n",
+                sizeof(client_node_t), sizeof(legacy_client_node_t), sizeof(client_hot_t));
+        fprintf(bench_out, "%-22s %8s %16s %16s %10s\n", "benchmark", "clients", "linked list ns", "hot/cold ns", "speedup");
+        for (int i = 0; i < population_count; i++) {
+            run_population(populations[i]);
+            fflush(bench_out);
+        }
+    }
+
+    if (run_ops) {
+        sample_requests[0] = view_of("say$ hello everyone, how is it going?");
+        sample_requests[1] = view_of("sayto$ user42 are you still there?");
+        sample_requests[2] = view_of("  conn$   user7  ");
+        sample_requests[3] = view_of("mute$user3");
+        sample_contents[0] = view_of("   hello everyone   ");
+        sample_contents[1] = view_of("\tuser42 are you still there?\n");
+        sample_contents[2] = view_of("user7");
+        sample_contents[3] = view_of("      ");
+
+        int max_threads = 1;
+        for (int t = 0; t < thread_count_count; t++) {
+            if (thread_counts[t] > max_threads) {
+                max_threads = thread_counts[t];
+            }
+        }
+        start_pool(max_threads);
+
+        if (run_layout) {
+            fprintf(bench_out, "\n");
+        }
+        fprintf(bench_out, "%-26s %8s %7s %12s %9s %9s %11s %12s\n", "operation", "clients", "threads", "ns/op",
+                "Mops/s", "locks/op", "contended%", "wait ns/op");
+        for (int i = 0; i < population_count; i++) {
+            run_ops_population(populations[i], i == 0, thread_counts, thread_count_count);
+        }
+        stop_pool();
+    }
+
+    destroy_timer_wheel();
+    destroy_history(&chat_history);
+    destroy_client_list();
+    destroy_slabs();
+    return 0;
+}
@@ -1,59 +1,277 @@
-
+// udp.h uses recvmmsg/sendmmsg, which are GNU extensions
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <time.h>
 #include <assert.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include "udp.h"
+#include "slab.h"
+#include "epoch.h"
+#include "history_log.h"
+#include "chat_wire.h"
+#include "chat_log.h"
+#include "chat_stats.h"
 
 #define MAX_NAME_LEN 256
 // Timeout threshold for inactive clients
 #define INACTIVITY_THRESHOLD 300 // 5 minutes in seconds
 #define PING_TIMEOUT 10          // 10 seconds to wait for ret-ping
-#define MONITOR_INTERVAL 30      // Check every 30 seconds
+#define MONITOR_INTERVAL 30      // Report stats every 30 seconds
+#define CLOCK_TICK_INTERVAL 1    // Seconds between coarse clock refreshes and timer wheel ticks
+
+// Timer wheel for inactivity pings and ping timeouts: 3 levels of 64 slots, 1 tick = 1 second
+#define TIMER_WHEEL_LEVELS 3
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_REMOVAL_BATCH 64   // Timed-out clients removed per write-lock section
+
+// Worker pool defaults (can be overridden on the command line)
+#define DEFAULT_WORKER_COUNT 4
+#define DEFAULT_QUEUE_CAPACITY 1024
+
+// Chat history: messages kept for new clients (can be overridden on the command line), stored in arena blocks
+#define DEFAULT_HISTORY_DEPTH 15
+#define HISTORY_BLOCK_SIZE 4096 // Bytes of records per arena block
+// Joins get the history packed into histpack$ datagrams of at most this many bytes:
+// an Ethernet frame's UDP payload (1500 - 20 IPv4 - 8 UDP), or less if the client's buffer is smaller
+#define HISTORY_PACK_MTU_PAYLOAD 1472
+#define HISTORY_PACK_MAX_BYTES (HISTORY_PACK_MTU_PAYLOAD < BUFFER_SIZE - 1 ? HISTORY_PACK_MTU_PAYLOAD : BUFFER_SIZE - 1)
+#define HISTORY_PACK_HEADER_MAX 40 // Room for "histpack$<count> <first seq>\n"
+#define DEFAULT_HISTORY_SEGMENT_KB 1024 // Size of each on-disk history log segment (log is off unless -D is given)
+#define DEFAULT_HISTORY_RETAIN_SEGMENTS 8 // Log segments kept on disk
+
+// Metrics report (stats$ and -M): one line per command plus two, well under this
+#define STATS_REPORT_MAX 4096
+
+// Event loop mode: max datagrams waiting in one loop's outbound queue before new ones are dropped
+#define MAX_OUTBOUND_QUEUE 65536
+
+// Client snapshots for broadcasts
+#define SNAPSHOT_CHUNK_MEMBERS 256 // Members per snapshot chunk (only changed chunks are copied)
+#define SNAPSHOT_DIRTY_MAX 64 // Changed chunks tracked per write section before the whole snapshot is rebuilt
+
+// Rooms (join$ / leave$)
+#define LOBBY_ROOM_NAME "lobby" // Where every client starts
+#define MAX_ROOM_NAME_LEN 32
+
+// A run of bytes inside a buffer someone else owns (usually the request's receive buffer)
+// Requests are parsed into views instead of being copied out, so it is not NUL-terminated:
+// print it with "%.*s", (int)view.length, view.data
+typedef struct {
+    const char *data;
+    size_t length;
+} str_view_t;
+
+str_view_t view_of(const char *str) {
+    str_view_t view = { str, strlen(str) };
+    return view;
+}
 
-//Helper function to do trimming
-char* trim(char *str){
-    if (!str){
-        return str;
+//Helper function to do trimming: drops the spaces at both ends by narrowing the view
+str_view_t view_trim(str_view_t view) {
+    while (view.length > 0 && view.data[0] == ' ') {
+        view.data++;
+        view.length--;
     }
+    while (view.length > 0 && view.data[view.length - 1] == ' ') {
+        view.length--;
+    }
+    return view;
+}
 
-    //Move pointer forward if it is just a space
-     while (*str == ' '){
-        str++;
+// Split view at the first delimiter: *head gets what comes before it and *tail what comes after
+// Returns -1 (views untouched) if there is no delimiter
+int view_split(str_view_t view, char delimiter, str_view_t *head, str_view_t *tail) {
+    const char *found = (const char *)memchr(view.data, delimiter, view.length);
+    if (found == NULL) {
+        return -1;
     }
+    head->data = view.data;
+    head->length = found - view.data;
+    tail->data = found + 1;
+    tail->length = view.length - head->length - 1;
+    return 0;
+}
 
-    char *end = str + strlen(str);
-        while (end > str && *(end - 1) == ' ') {
-            end--;
-        }
-    *end = '\0'; // Null-terminate at the trimmed position
-    
-    return str;
+// Whether view holds exactly the C string str
+int view_equals(str_view_t view, const char *str) {
+    return strncmp(str, view.data, view.length) == 0 && str[view.length] == '\0';
 }
 
 
+// Small sorted set of integer ids (client ids or muted name ids)
+// Membership is a binary search over a compact array, much cheaper than comparing names
+typedef struct {
+    uint32_t *ids;
+    int count;
+    int capacity;
+} id_set_t;
+
 // This is a structure representing a single client in our chat system
-// This is a node in our linked list 
+// It holds the "cold" fields, only needed once a particular client has been found;
+// the fields every walk over all clients reads live in the client's client_hot_t record
 typedef struct client_node { 
-    char client_name[MAX_NAME_LEN];
-    struct sockaddr_in client_address; //Stores IP and port needed to send back to the client
+    char *client_name; // From the name store (see name_store_dup)
+    struct sockaddr_in client_address; //Stores IP and port needed to send back to the client (index key, never changes)
 
-    struct client_node *next; //Builds the linked list
+    uint32_t hot_index; // Position of this client's record in client_list.hot
 
-    time_t last_active_time;
+    uint32_t client_id; // Small integer id, unique among connected clients (reused after disconnect)
+
+    uint32_t generation; // Tells this client apart from earlier holders of the same client_id (see client_timer_t)
 
     int is_admin;
 
-    muted_node_t *muted_head; // Head of linked list of muted clients
-    // This stores which clients THIS client has muted
+    wire_format_t wire_format; // How the client asked to be spoken to (chosen at conn$, never changes)
+
+    id_set_t muted_names; // name_ids of the names THIS client has muted
+
+    _Atomic(struct room *) room; // The room the client is in (changed under the write lock, read by say$ in an epoch)
+    uint32_t room_position;      // Position of the client in its room's member array
 
 } client_node_t;
 
+// The fields a broadcast or the inactivity check reads for every client, packed into 32 bytes
+// so a walk over all clients streams through one contiguous array (two records per cache line)
+typedef struct {
+    struct sockaddr_in client_address;
+    _Atomic time_t last_active_time; // Stored with the read lock held (see update_client_active_time)
+    uint32_t client_id;
+    uint8_t wire_format; // Copy of the node's, for the snapshot (fits in what would be padding)
+} client_hot_t;
+
+// A name that at least one client has muted
+// Mutes are by name: if the muted client renames they are no longer muted, and whoever takes the name later is.
+// The entry exists for as long as somebody mutes the name
+typedef struct {
+    uint32_t name_id;
+    id_set_t muters; // Reverse index: client_id of every client muting this name
+    char *name;      // The muted name, from the name store
+} muted_name_t;
+
+// What a hash index is keyed on
+typedef enum {
+    INDEX_BY_ADDRESS,   // client_node_t, keyed on (IPv4 address, port)
+    INDEX_BY_NAME,      // client_node_t, keyed on client_name
+    INDEX_BY_MUTED_NAME, // muted_name_t, keyed on name
+    INDEX_BY_ROOM_NAME   // room_t, keyed on name
+} index_key_t;
+
+// Open-addressing hash table from a key (address or name) to an entry
+// Linear probing over a power-of-two table kept at most half full, so a lookup
+// is one or two probes no matter how many entries there are
+typedef struct {
+    void **slots; // NULL = empty slot
+    size_t capacity;
+    size_t count;
+    index_key_t key_type;
+} hash_index_t;
+
+// Hands out small integer ids and reuses released ones
+typedef struct {
+    uint32_t next_id;
+    uint32_t *free_ids;
+    int free_count;
+    int free_capacity;
+} id_pool_t;
+
+// Every muted name, by name and by name_id (protected by client_list.lock)
+typedef struct {
+    hash_index_t by_name;
+    muted_name_t **by_id; // Indexed by name_id
+    uint32_t by_id_capacity;
+    id_pool_t name_ids;
+} muted_name_table_t;
+
+// Read-only copy of the membership and mutes that broadcasts walk without taking the client list lock
+// Writers never modify a published snapshot: they publish a new one when they release the write lock and
+// retire the old one through epoch.h, so a broadcast that still holds it can finish first.
+// Members are split into chunks mirroring client_list.hot; chunks nobody changed are shared with the new version
+typedef struct {
+    struct sockaddr_in client_address;
+    uint32_t client_id;
+    uint8_t wire_format; // Whether broadcasts reach this member as text or as a frame
+} snapshot_member_t;
+
+typedef struct {
+    snapshot_member_t members[SNAPSHOT_CHUNK_MEMBERS];
+} snapshot_chunk_t;
+
+typedef struct {
+    const char *name;       // NULL = empty slot
+    const uint32_t *muters; // Sorted client_ids of everyone muting the name
+    int muter_count;
+} snapshot_muted_name_t;
+
+// Hash table of muted names (one allocation, names and muter ids stored after the slots)
 typedef struct {
-    client_node_t *head;
+    size_t capacity; // Power of two, at most half full
+    snapshot_muted_name_t slots[];
+} snapshot_mutes_t;
+
+// Chunks of a member array changed in the current write section, so the next snapshot copies only those
+typedef struct {
+    uint32_t chunks[SNAPSHOT_DIRTY_MAX];
+    int count;
+    int all; // More chunks changed than are tracked: copy every chunk
+} dirty_chunks_t;
+
+typedef struct {
+    uint32_t member_count;
+    uint32_t chunk_count;
+    snapshot_mutes_t *mutes; // NULL when nobody is muted
+    snapshot_chunk_t *chunks[];
+} client_snapshot_t;
+
+// Read-only copy of a room's members, published and retired like client_snapshot_t
+// (a room's mutes are the global ones: muting is by name, whatever room the muted client is in)
+typedef struct {
+    uint32_t member_count;
+    uint32_t chunk_count;
+    snapshot_chunk_t *chunks[];
+} room_snapshot_t;
+
+typedef struct {
+    // Connected clients, in no particular order: hot[i] and nodes[i] describe the same client
+    // Removal moves the last client into the freed position, so both arrays stay dense
+    client_hot_t *hot;
+    client_node_t **nodes;
+    uint32_t count;
+    uint32_t capacity;
+
+    // Connected clients by client_id (NULL = id not in use), for the timer wheel
+    client_node_t **by_id;
+    uint32_t by_id_capacity;
+    uint32_t next_generation;
+
+    // Every connected client is in both indexes, kept in sync under the write lock
+    hash_index_t address_index;
+    hash_index_t name_index;
+
+    id_pool_t client_ids;
+    muted_name_table_t muted_names;
+
+    // Published snapshot for broadcasts, and what changed since (changes are protected by lock)
+    _Atomic(client_snapshot_t *) snapshot;
+    int snapshot_dirty;
+    int snapshot_mutes_dirty;
+    dirty_chunks_t snapshot_dirty_chunks;
+
+    // Rooms by name, the lobby every client starts in, and the rooms whose members changed in this write section
+    hash_index_t room_index;
+    struct room *lobby;
+    struct room *dirty_rooms;
+    uint32_t room_count;
 
     pthread_rwlock_t lock;
 
@@ -61,45 +279,219 @@ typedef struct {
 
 // Structure to pass data to worker threads
 // Contains request message, client address, and socket descriptor
+// The length is kept because a binary frame can contain zero bytes
 typedef struct {
     char request[BUFFER_SIZE];
+    int request_length;
     struct sockaddr_in client_address;
     int socket_descriptor;
 } request_handler_t;
 
-// Structure to track clients that are being pinged
-// We need to know which clients we've pinged and when, so that we can check for timeouts
-typedef struct ping_tracker {
-    struct sockaddr_in client_address; // Address of the client we pinged
-    time_t ping_time;                  // Time we pinged the client
-    struct ping_tracker *next;         // Linked list of pinged clients
-} ping_tracker_t;
+// What the listener does when the request queue is full
+typedef enum {
+    OVERFLOW_DROP_NEWEST, // Drop the request that just arrived
+    OVERFLOW_DROP_OLDEST  // Evict the oldest queued request to make room
+} overflow_policy_t;
 
-// Global list of clients currently being pinged
-// This is separate from the client list - it only tracks who we've pinged
+// Bounded ring of preallocated request slots
+// The listener pushes requests in, the worker pool pops them out
+// No memory is allocated per request, and a burst can never hold more than 'capacity' requests
 typedef struct {
-    ping_tracker_t *head;
-    pthread_mutex_t lock;  // Mutex for thread-safe access
-} ping_list_t;
+    request_handler_t *slots;
+    int capacity;
+    int head;  // Index of the oldest queued request
+    int count; // Number of queued requests
 
-// Global ping list - shared by monitoring thread and main thread
-ping_list_t ping_list;
+    overflow_policy_t overflow_policy;
 
-// Forward declaration for muted_node_t (needed because client_node_t uses it)
-typedef struct muted_node muted_node_t;
+    // Counters (protected by lock)
+    unsigned long enqueued;
+    unsigned long dropped_newest;
+    unsigned long dropped_oldest;
+    unsigned long batches; // Number of recvmmsg batches pushed (enqueued + dropped / batches = average batch size)
 
-//This represents one muted client in the list
-struct muted_node {
-    char client_name[MAX_NAME_LEN];
-    muted_node_t *next;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty; // Signalled when a request is pushed
+} request_queue_t;
+
+// Server settings chosen at startup
+typedef struct {
+    int worker_count;   // Worker threads per shard
+    int queue_capacity; // Request queue slots per shard
+    overflow_policy_t overflow_policy;
+    int listener_count; // Number of SO_REUSEPORT sockets (shards) bound to SERVER_PORT
+    int event_loop;     // 1 = one epoll event loop per shard instead of listener + worker + monitor threads
+    int history_depth;  // Chat history messages kept for new clients
+    const char *history_directory; // Directory of the persistent history log, NULL = history is not persisted
+    int history_segment_kb;        // Size of each log segment
+    int history_retain_segments;   // Log segments kept on disk
+    log_level_t log_level;         // Lines below this level are not logged
+    const char *log_path;          // File the logger appends to, NULL = stdout
+    const char *stats_path;        // File the metrics report is appended to every MONITOR_INTERVAL, NULL = no dump
+} server_config_t;
+
+server_config_t server_config = {
+    DEFAULT_WORKER_COUNT,
+    DEFAULT_QUEUE_CAPACITY,
+    OVERFLOW_DROP_NEWEST,
+    1,
+    0,
+    DEFAULT_HISTORY_DEPTH,
+    NULL,
+    DEFAULT_HISTORY_SEGMENT_KB,
+    DEFAULT_HISTORY_RETAIN_SEGMENTS,
+    LOG_LEVEL_INFO,
+    NULL,
+    NULL
 };
-typedef struct{
-    char messages_history [15] [BUFFER_SIZE];
-    int current_index_pointer;
-    int message_count;
+
+// A datagram the event loop could not send yet because the socket buffer was full
+typedef struct outbound_message {
+    struct sockaddr_in address;
+    int length;
+    struct outbound_message *next;
+    char data[BUFFER_SIZE]; // 'length' bytes of message (fixed size so messages come from a slab)
+} outbound_message_t;
+
+// One receive shard: a socket bound to SERVER_PORT with its own listener thread, request queue and worker pool
+// With more than one shard every socket sets SO_REUSEPORT and the kernel spreads clients across them
+// Shards only own the receive path - the client list and chat history are shared by all of them
+// In event loop mode the shard has no queue or workers - one thread waits on epoll and runs handlers inline
+typedef struct {
+    int index;
+    int socket_descriptor;
+    request_queue_t queue;
+    pthread_t listener_tid;
+    pthread_t *worker_tids;
+
+    // Event loop mode only (only touched by the shard's own loop thread)
+    int epoll_fd;
+    int timer_fd;                      // Clock, client timer and stats timer, -1 on every shard but the first
+    unsigned long timer_ticks;
+    outbound_message_t *outbound_head; // Datagrams waiting for the socket to become writable (FIFO)
+    outbound_message_t *outbound_tail;
+    int outbound_count;
+    unsigned long outbound_dropped;
+} server_shard_t;
+
+server_shard_t *shards;
+
+// The shard whose event loop is running on this thread (NULL on listener/worker/monitor threads)
+__thread server_shard_t *current_event_loop;
+
+// What a client's timer is waiting for
+typedef enum {
+    TIMER_INACTIVITY,  // Deadline for the client's next request; expiring sends a ping
+    TIMER_PING_TIMEOUT // Deadline for an answer to the ping; expiring removes the client
+} client_timer_kind_t;
+
+// A pending timer. Every connected client has exactly one, which switches between the two kinds.
+// Timers name their client by (client_id, generation) instead of by pointer, so a client that leaves
+// needs no cancellation: its timer is simply dropped when it expires and finds nobody
+typedef struct client_timer {
+    time_t deadline;
+    time_t armed_time; // When the timer was last scheduled (for a ping timeout: when the ping went out)
+    uint32_t client_id;
+    uint32_t generation;
+    client_timer_kind_t kind;
+    struct client_timer *next;
+} client_timer_t;
+
+// Hierarchical timer wheel with 1-second ticks
+// Level 0 has a slot per tick for the next 64 ticks, level 1 a slot per 64 ticks, level 2 a slot per 4096 ticks.
+// Timers move down a level when their slot comes up, so a tick only touches timers that are due (or nearly)
+typedef struct {
+    client_timer_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    time_t current_tick; // Every timer due up to here has fired
+    size_t pending;
     pthread_mutex_t lock;
+} timer_wheel_t;
+
+// Global timer wheel - scheduled by workers (conn$) and the monitor, advanced by the monitor
+timer_wheel_t client_timers;
+
+// Chat history records live in a chain of arena blocks, appended at the tail and dropped from the head.
+// Each record is a history_record_t header followed by its payload ("name: message", no terminator),
+// padded to 8 bytes. Records are never modified once written, and a block that no longer holds a kept
+// record is retired through the epoch, so readers walk the history in place without holding the lock
+typedef struct history_block {
+    struct history_block *next; // Newer block
+    _Atomic size_t used;        // Bytes of records written (grows while readers walk the block)
+    char data[HISTORY_BLOCK_SIZE];
+} history_block_t;
+
+typedef struct {
+    uint64_t seq;    // Position of the message in the whole chat, starting at 1
+    uint32_t length; // Payload bytes following the header
+} history_record_t;
+
+typedef struct {
+    history_block_t *head;  // Block holding the oldest kept record
+    history_block_t *tail;  // Block new records are appended to
+    size_t head_offset;     // Offset of the oldest kept record in head
+    uint64_t first_seq;     // seq of the oldest kept record
+    uint64_t next_seq;      // seq the next record gets
+    size_t depth;           // Max records kept
+    size_t payload_bytes;   // Payload bytes of the kept records
+    size_t block_count;
+    history_log_t *log;     // On-disk copy of every message (history_log.h), NULL unless -D was given
+    pthread_mutex_t lock;   // Serialises writers and the readers' snapshot of head/next_seq
 } chat_history_t;
 
+// One history message, read in place from the arena
+// Valid until the reader's epoch_exit
+typedef struct {
+    uint64_t seq;
+    const char *data;
+    uint32_t length;
+} history_span_t;
+
+// Reader position in the history, covering the records kept when it was opened
+typedef struct {
+    history_block_t *block;
+    size_t offset;
+    uint64_t seq;
+    uint64_t end_seq;
+} history_cursor_t;
+
+// A chat room. Every client is in exactly one, and say$ only reaches the members of the sender's room.
+// Members are protected by client_list.lock like the rest of the client list; say$ walks the published
+// snapshot instead, so a message costs O(room size) and never waits for a join$ or leave$
+typedef struct room {
+    char *name;                 // From the name store, never changes
+    snapshot_member_t *members; // Dense, in no particular order (removal moves the last member into the gap)
+    uint32_t member_count;
+    uint32_t member_capacity;
+    _Atomic(room_snapshot_t *) snapshot;
+    dirty_chunks_t dirty_chunks;
+    int dirty;                  // On client_list.dirty_rooms: unlock publishes it, or deletes it once empty
+    struct room *next_dirty;
+    chat_history_t *history;    // The lobby's is chat_history (numbered, persisted and resumed by reconn$)
+    chat_history_t own_history; // Every other room keeps its last history_depth messages in memory
+} room_t;
+
+// Seconds on CLOCK_MONOTONIC_COARSE, refreshed every CLOCK_TICK_INTERVAL by the clock thread (or the event
+// loop timer), so the request path reads one shared variable instead of making a clock call per request.
+// Being monotonic, activity and ping deadlines are not thrown off when the wall clock is changed
+_Atomic time_t coarse_clock;
+
+void refresh_coarse_clock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    atomic_store_explicit(&coarse_clock, now.tv_sec, memory_order_relaxed);
+}
+
+time_t coarse_now() {
+    return atomic_load_explicit(&coarse_clock, memory_order_relaxed);
+}
+
+// Forward declarations: the client list helpers below clear mutes, publish snapshots and schedule timers
+void cleanup_muted_list(client_node_t *client);
+void publish_client_snapshot_locked();
+void publish_room_snapshots_locked();
+struct room *create_room_locked(str_view_t name);
+void timer_wheel_schedule(timer_wheel_t *wheel, client_timer_t *timer);
+
 //Global client list - shared by all threads
 //This is where we store all the connected clients
 client_list_t client_list; 
@@ -107,709 +499,2356 @@ client_list_t client_list;
 //Global chat history list - shared by all threads
 //This is where we store all the chat history
 chat_history_t chat_history;
-
-//Initialize the client list
-void init_client_list() {
-    client_list.head = NULL;
-
-    //Initialize the read-write lock
-    int rc = pthread_rwlock_init(&client_list.lock, NULL);
-
-    if (rc != 0) {
-        fprintf(stderr, "Failed to initialize reader-writer lock\n");
-        exit(1);
+history_log_t chat_history_log;
+
+// Slabs for the objects created and freed while the server runs
+// Each thread keeps a small cache of free objects, so allocating rarely touches a shared lock,
+// and the monitor reports live/free counts so memory use stays visible
+slab_t client_slab;         // client_node_t
+slab_t muted_name_slab;     // muted_name_t
+slab_t client_timer_slab;   // client_timer_t
+slab_t outbound_slab;       // outbound_message_t (event loop mode)
+
+// Variable-length name store: client and muted names are copied into the smallest size class that fits
+#define NAME_STORE_CLASSES 5
+const size_t name_store_class_sizes[NAME_STORE_CLASSES] = {16, 32, 64, 128, MAX_NAME_LEN};
+slab_t name_store_slabs[NAME_STORE_CLASSES];
+
+// Locking is switched off when a single event loop runs every handler on one thread
+int locking_enabled = 1;
+
+// Write sections on the client list since startup (reported by the monitor)
+atomic_ulong client_list_write_locks;
+
+// Each wrapper tries the lock first, so an uncontended acquisition costs no clock calls,
+// and only a thread that has to wait times how long it waited (see stats_record_lock)
+void client_list_read_lock() {
+    if (locking_enabled) {
+        if (pthread_rwlock_tryrdlock(&client_list.lock) == 0) {
+            stats_record_lock(STATS_LOCK_CLIENT_LIST_READ, 0, 0);
+            return;
+        }
+        uint64_t start_ns = stats_now_ns();
+        pthread_rwlock_rdlock(&client_list.lock);
+        stats_record_lock(STATS_LOCK_CLIENT_LIST_READ, 1, stats_now_ns() - start_ns);
     }
-    printf("[DEBUG] Client list initialized\n");
 }
 
-void init_chat_history() {
-    chat_history.current_index_pointer = 0;
-    chat_history.message_count = 0;
-    //empties chat history
-    memset(chat_history.messages_history, 0, sizeof(chat_history.messages_history));
-    //initialise the lock
-    pthread_mutex_init(&chat_history.lock, NULL);
+void client_list_write_lock() {
+    atomic_fetch_add_explicit(&client_list_write_locks, 1, memory_order_relaxed);
+    if (locking_enabled) {
+        if (pthread_rwlock_trywrlock(&client_list.lock) == 0) {
+            stats_record_lock(STATS_LOCK_CLIENT_LIST_WRITE, 0, 0);
+            return;
+        }
+        uint64_t start_ns = stats_now_ns();
+        pthread_rwlock_wrlock(&client_list.lock);
+        stats_record_lock(STATS_LOCK_CLIENT_LIST_WRITE, 1, stats_now_ns() - start_ns);
+    }
 }
 
-// Initialize the ping tracking list
-void init_ping_list() {
-    ping_list.head = NULL;
-    int rc = pthread_mutex_init(&ping_list.lock, NULL);
-    if (rc != 0) {
-        fprintf(stderr, "Failed to initialize ping list mutex\n");
-        exit(1);
+// A writer's changes become visible to broadcasts here, in one new snapshot per write section
+// (only writers set snapshot_dirty, and no writer can be active while a reader holds the lock)
+void client_list_unlock() {
+    if (client_list.snapshot_dirty) {
+        publish_client_snapshot_locked();
+    }
+    if (client_list.dirty_rooms != NULL) {
+        publish_room_snapshots_locked();
+    }
+    if (locking_enabled) {
+        pthread_rwlock_unlock(&client_list.lock);
     }
-    printf("[DEBUG] Ping list initialized\n");
 }
 
-// Function to clean up the client list (Called on server shutdown)
-void destroy_client_list() {
-    // Acquire the write lock
-    pthread_rwlock_wrlock(&client_list.lock);
-
-    //Free all the client nodes
-    client_node_t *current = client_list.head;
-    while (current != NULL) {
-        client_node_t *temp = current->next;
-        cleanup_muted_list(current);  // Clean up muted list first
-        free(current);
-        current = temp;
+// Used for the history mutexes (the lobby's and every room's) and the timer wheel mutex
+void shared_mutex_lock(pthread_mutex_t *lock) {
+    if (locking_enabled) {
+        stats_lock_t kind = lock == &client_timers.lock ? STATS_LOCK_TIMERS : STATS_LOCK_HISTORY;
+        if (pthread_mutex_trylock(lock) == 0) {
+            stats_record_lock(kind, 0, 0);
+            return;
+        }
+        uint64_t start_ns = stats_now_ns();
+        pthread_mutex_lock(lock);
+        stats_record_lock(kind, 1, stats_now_ns() - start_ns);
     }
+}
 
-    client_list.head = NULL;
-
-    // Release the write lock
-    pthread_rwlock_unlock(&client_list.lock);
+void shared_mutex_unlock(pthread_mutex_t *lock) {
+    if (locking_enabled) {
+        pthread_mutex_unlock(lock);
+    }
+}
 
-    // Destroy the lock itself
-    pthread_rwlock_destroy(&client_list.lock);
+// Queue a datagram on the current event loop and ask epoll to tell us when the socket is writable again
+// Returns 0 if queued, -1 if dropped
+int queue_outbound(server_shard_t *loop, struct sockaddr_in *address, const char *buffer, int n) {
+    if (loop->outbound_count >= MAX_OUTBOUND_QUEUE || n > BUFFER_SIZE) {
+        loop->outbound_dropped++;
+        return -1;
+    }
 
-    printf("[DEBUG] Client list destroyed\n");
+    outbound_message_t *message = (outbound_message_t *)slab_alloc(&outbound_slab);
+    if (message == NULL) {
+        loop->outbound_dropped++;
+        return -1;
+    }
+    message->address = *address;
+    message->length = n;
+    message->next = NULL;
+    memcpy(message->data, buffer, n);
+
+    if (loop->outbound_tail == NULL) {
+        loop->outbound_head = message;
+
+        // First queued datagram - start watching for EPOLLOUT
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT;
+        event.data.fd = loop->socket_descriptor;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, loop->socket_descriptor, &event);
+    } else {
+        loop->outbound_tail->next = message;
+    }
+    loop->outbound_tail = message;
+    loop->outbound_count++;
+    return 0;
 }
 
-// Function to add a new client to the list
-client_node_t *add_client(const char *client_name, struct sockaddr_in *client_address, int is_admin) {
-    // Allocate memory for the new client node
-    client_node_t *new_node = (client_node_t *)malloc(sizeof(client_node_t));
+// Send as much of the outbound queue as the socket will take (called on EPOLLOUT)
+void flush_outbound(server_shard_t *loop) {
+    while (loop->outbound_head != NULL) {
+        outbound_message_t *message = loop->outbound_head;
+        int rc = udp_socket_write(loop->socket_descriptor, &message->address, message->data, message->length);
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return; // Still full - wait for the next EPOLLOUT
+        }
 
-    if (new_node == NULL) {
-        fprintf(stderr, "Failed to allocate memory for new client\n");
-        return NULL;
+        loop->outbound_head = message->next;
+        loop->outbound_count--;
+        slab_free(&outbound_slab, message);
     }
+    loop->outbound_tail = NULL;
 
-    // Initialize muted list to empty
-    new_node->muted_head = NULL;
-
-    // Copy the client name into the node
-    // Use strncpy instead of strcpy to avoid buffer overflow
-    strncpy(new_node->client_name, client_name, MAX_NAME_LEN - 1);
-    new_node->client_name[MAX_NAME_LEN - 1] = '\0'; // Ensure null termination (for safety)
+    // Queue drained - only wake up for incoming datagrams again
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = loop->socket_descriptor;
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, loop->socket_descriptor, &event);
+}
 
-    // Copy the client address into the node
-    new_node->client_address = *client_address;
+// Every reply goes through here
+// In thread mode this is just udp_socket_write. In event loop mode the socket is non-blocking, so if the
+// kernel buffer is full (or older datagrams are already waiting) the datagram joins the loop's outbound queue
+int send_to_client(int socket_descriptor, struct sockaddr_in *address, const char *buffer, int n) {
+    server_shard_t *loop = current_event_loop;
+    int rc = -1;
+    if (loop == NULL) {
+        rc = udp_socket_write(socket_descriptor, address, (char *)buffer, n);
+    } else {
+        // Keep ordering: once something is queued, everything after it queues behind it
+        int queue = loop->outbound_head != NULL;
+        if (!queue) {
+            rc = udp_socket_write(socket_descriptor, address, (char *)buffer, n);
+            queue = rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+        if (queue) {
+            rc = queue_outbound(loop, address, buffer, n) == 0 ? n : -1;
+        }
+    }
+    if (rc < 0) {
+        stats_record_event(send_failures);
+    }
+    return rc;
+}
 
-    // Set admin flag
-    new_node->is_admin = is_admin;
+// Fan-out version of send_to_client (same message to many clients)
+int send_to_clients(int socket_descriptor, struct sockaddr_in *addresses, int count, const char *buffer, int n) {
+    server_shard_t *loop = current_event_loop;
+    int handled = 0;
+    int skipped = 0;
 
-    // Set the last active time to the current time
-    new_node->last_active_time = time(NULL);
+    if (loop == NULL || loop->outbound_head == NULL) {
+        handled = udp_socket_write_batch(socket_descriptor, addresses, count, (char *)buffer, n, &skipped);
+    }
+    // Destinations sendmmsg rejected are not retried
+    for (int i = 0; i < skipped; i++) {
+        stats_record_event(send_failures);
+    }
 
+    // Whatever the socket could not take right now waits in the outbound queue
+    if (loop != NULL) {
+        for (int i = handled; i < count; i++) {
+            if (queue_outbound(loop, &addresses[i], buffer, n) != 0) {
+                stats_record_event(send_failures);
+            }
+        }
+    }
+    return count;
+}
 
-    // Acquire the write lock
-    pthread_rwlock_wrlock(&client_list.lock);
+// Framing of the request being handled on this thread, which is how its replies are framed
+__thread wire_format_t request_format;
+// seq from the frame header of the request being handled (binary requests only)
+__thread uint32_t request_seq;
 
-    // Add node to the FRONT of the list
-    new_node->next = client_list.head;
+// Send a text message ("command$ content\n") to a client in the framing it asked for
+// Handlers build every message as text; a binary client gets it converted into a frame just before sending
+int send_message(int socket_descriptor, struct sockaddr_in *address, wire_format_t format, const char *message, int n) {
+    if (format == WIRE_TEXT) {
+        return send_to_client(socket_descriptor, address, message, n);
+    }
+    char frame[BUFFER_SIZE];
+    int frame_length = wire_encode_text(frame, sizeof(frame), message, n, 1);
+    if (frame_length < 0) {
+        fprintf(stderr, "Failed to frame message '%.*s'\n", n, message);
+        return -1;
+    }
+    return send_to_client(socket_descriptor, address, frame, frame_length);
+}
 
-    client_list.head = new_node;
+// Reply to the client whose request is being handled
+int send_reply(int socket_descriptor, struct sockaddr_in *address, const char *message, int n) {
+    return send_message(socket_descriptor, address, request_format, message, n);
+}
 
-    pthread_rwlock_unlock(&client_list.lock);
+#define HASH_INDEX_INITIAL_CAPACITY 64
 
-    printf("[DEBUG] Client %s added to the list\n", client_name);
-    return new_node;
+// 64-bit mix (from splitmix64) so nearby keys spread across the table
+uint64_t mix_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
 }
 
-// Helper function to find a client by name while lock is already held
-client_node_t *find_client_by_name_locked(const char *client_name) {
-    client_node_t *current = client_list.head;
+// Hash an IPv4 address and port into a table position
+size_t address_hash(const struct sockaddr_in *address) {
+    uint64_t key = ((uint64_t)address->sin_addr.s_addr << 16) | address->sin_port;
+    return (size_t)mix_hash(key);
+}
 
-    while (current != NULL) {
-        if (strcmp(current->client_name, client_name) == 0) {
-            return current;
-        }
-        current = current->next;
+// Hash a client name (FNV-1a)
+size_t name_hash(str_view_t name) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < name.length; i++) {
+        hash ^= (unsigned char)name.data[i];
+        hash *= 0x100000001b3ULL;
     }
-    return NULL;
+    return (size_t)mix_hash(hash);
 }
 
-// Function to find a client by their chat name
-client_node_t *find_client_by_name(const char *client_name) {
-    // Acquire the read lock
-    pthread_rwlock_rdlock(&client_list.lock);
-
-    // Find the client by name
-    client_node_t *result = find_client_by_name_locked(client_name);
+int same_address(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
 
-    pthread_rwlock_unlock(&client_list.lock);
+// Name an entry is keyed on (name indexes only)
+const char *hash_index_entry_name(hash_index_t *index, void *entry) {
+    if (index->key_type == INDEX_BY_MUTED_NAME) {
+        return ((muted_name_t *)entry)->name;
+    }
+    if (index->key_type == INDEX_BY_ROOM_NAME) {
+        return ((room_t *)entry)->name;
+    }
+    return ((client_node_t *)entry)->client_name;
+}
 
-    return result;
+// Hash of the entry's own key for this index
+size_t hash_index_entry_hash(hash_index_t *index, void *entry) {
+    if (index->key_type == INDEX_BY_ADDRESS) {
+        return address_hash(&((client_node_t *)entry)->client_address);
+    }
+    return name_hash(view_of(hash_index_entry_name(index, entry)));
 }
 
-// Function to find a client by their IP address and port number
-client_node_t *find_client_by_address(struct sockaddr_in *client_address) {
-    pthread_rwlock_rdlock(&client_list.lock);
+int init_hash_index(hash_index_t *index, size_t capacity, index_key_t key_type) {
+    index->slots = (void **)calloc(capacity, sizeof(void *));
+    if (index->slots == NULL) {
+        return -1;
+    }
+    index->capacity = capacity;
+    index->count = 0;
+    index->key_type = key_type;
+    return 0;
+}
 
-    client_node_t *current = client_list.head;
-    while (current != NULL) {
-        if (current->client_address.sin_addr.s_addr == client_address->sin_addr.s_addr && current->client_address.sin_port == client_address->sin_port) {
-            pthread_rwlock_unlock(&client_list.lock);
-            return current;
+// Find the client at an address (client list lock must be held)
+client_node_t *hash_index_find_address(hash_index_t *index, const struct sockaddr_in *address) {
+    size_t mask = index->capacity - 1;
+    size_t position = address_hash(address) & mask;
+    while (index->slots[position] != NULL) {
+        client_node_t *node = (client_node_t *)index->slots[position];
+        if (same_address(&node->client_address, address)) {
+            return node;
         }
-        current = current->next;
+        position = (position + 1) & mask;
     }
-    // Not found - release lock and return NULL
-    pthread_rwlock_unlock(&client_list.lock);
     return NULL;
 }
 
-// Helper function to find client by address when lock is already held
-client_node_t *find_client_by_address_locked(struct sockaddr_in *client_address) {
-    client_node_t *current = client_list.head;
-    while (current != NULL) {
-        if (current->client_address.sin_addr.s_addr == client_address->sin_addr.s_addr &&
-            current->client_address.sin_port == client_address->sin_port) {
-            return current;
+// Find the entry with a name in a name index (client list lock must be held)
+void *hash_index_find_name(hash_index_t *index, str_view_t name) {
+    size_t mask = index->capacity - 1;
+    size_t position = name_hash(name) & mask;
+    while (index->slots[position] != NULL) {
+        if (view_equals(name, hash_index_entry_name(index, index->slots[position]))) {
+            return index->slots[position];
         }
-        current = current->next;
+        position = (position + 1) & mask;
     }
     return NULL;
 }
 
-// Function to remove a client from the list by their name
-int remove_client_by_name(const char *client_name) {
-    pthread_rwlock_wrlock(&client_list.lock);
-    
-    if (client_list.head != NULL && 
-        strcmp(client_list.head->client_name, client_name) == 0) {
-        // Head node matches - we need to remove it
-        
-        // Save pointer to the node we're about to remove
-        client_node_t *to_remove = client_list.head;
-        
-        // Move head pointer to the next node (or NULL if it was the only node)
-        client_list.head = client_list.head->next;
-        
-        // Clean up muted list before freeing
-        cleanup_muted_list(to_remove);
-        
-        // Now we can safely free the old head node
-        free(to_remove);
-        
-        // Release lock and return success
-        pthread_rwlock_unlock(&client_list.lock);
-        printf("[DEBUG] Client '%s' removed from list (was head node)\n", client_name);
-        return 0;
+// Put an entry into the table without checking the load factor
+void hash_index_place(hash_index_t *index, void *entry) {
+    size_t mask = index->capacity - 1;
+    size_t position = hash_index_entry_hash(index, entry) & mask;
+    while (index->slots[position] != NULL) {
+        position = (position + 1) & mask;
     }
+    index->slots[position] = entry;
+    index->count++;
+}
 
-    client_node_t *current = client_list.head;
-
-    while (current != NULL && current->next != NULL) {
-        // Check if the NEXT node is the one we want to remove
-        if (strcmp(current->next->client_name, client_name) == 0) {
-            
-            client_node_t *to_remove = current->next;
-            
-            current->next = to_remove->next;
-
-            // Clean up muted list before freeing
-            cleanup_muted_list(to_remove);
-            
-            free(to_remove);
-            
-            pthread_rwlock_unlock(&client_list.lock);
-            printf("[DEBUG] Client '%s' removed from list\n", client_name);
-            return 0;
+// Add an entry (write lock must be held). The caller makes sure the key is not already in the table
+// Returns 0 on success, -1 if the table could not grow
+int hash_index_insert(hash_index_t *index, void *entry) {
+    // Keep the table at most half full so probe sequences stay short
+    if ((index->count + 1) * 2 > index->capacity) {
+        hash_index_t grown;
+        if (init_hash_index(&grown, index->capacity * 2, index->key_type) != 0) {
+            return -1;
         }
-        
-        // Move to next node
-        current = current->next;
+        for (size_t i = 0; i < index->capacity; i++) {
+            if (index->slots[i] != NULL) {
+                hash_index_place(&grown, index->slots[i]);
+            }
+        }
+        free(index->slots);
+        *index = grown;
     }
-    
-    // If we get here, we didn't find the client to remove
-    pthread_rwlock_unlock(&client_list.lock);
-    printf("[DEBUG] Client '%s' not found for removal\n", client_name);
-    return -1;  // Not found
+    hash_index_place(index, entry);
+    return 0;
 }
 
-// Helper function to remove client by address when lock is already held
-int remove_client_by_address_locked(struct sockaddr_in *client_address) {
-    // Check if head node matches
-    if (client_list.head != NULL) {
-        if (client_list.head->client_address.sin_addr.s_addr == client_address->sin_addr.s_addr &&
-            client_list.head->client_address.sin_port == client_address->sin_port) {
-            // Head node matches - remove it
-            client_node_t *to_remove = client_list.head;
-            client_list.head = client_list.head->next;
-            cleanup_muted_list(to_remove);  // Clean up muted list first
-            free(to_remove);
-            return 0;
-        }
+// Remove an entry (write lock must be held, and the entry's key must not have changed since it was inserted)
+// Uses backward-shift deletion, so there are no tombstones and lookups never slow down over time
+void hash_index_remove(hash_index_t *index, void *entry) {
+    size_t mask = index->capacity - 1;
+    size_t position = hash_index_entry_hash(index, entry) & mask;
+    while (index->slots[position] != NULL && index->slots[position] != entry) {
+        position = (position + 1) & mask;
+    }
+    if (index->slots[position] == NULL) {
+        return; // Not in the table
     }
 
-    // Check rest of list (same logic as remove_client_by_name)
-    client_node_t *current = client_list.head;
-    while (current != NULL && current->next != NULL) {
-        if (current->next->client_address.sin_addr.s_addr == client_address->sin_addr.s_addr &&
-            current->next->client_address.sin_port == client_address->sin_port) {
-            // Found it!
-            client_node_t *to_remove = current->next;
-            current->next = to_remove->next;
-            cleanup_muted_list(to_remove);  // Clean up muted list first
-            free(to_remove);
-            return 0;
+    // Close the gap: pull back any later entry in the run that would otherwise become unreachable
+    size_t gap = position;
+    size_t next = (gap + 1) & mask;
+    while (index->slots[next] != NULL) {
+        size_t home = hash_index_entry_hash(index, index->slots[next]) & mask;
+        // Move the entry if its home slot is not between the gap and its current slot (cyclically)
+        if (((next - home) & mask) >= ((next - gap) & mask)) {
+            index->slots[gap] = index->slots[next];
+            gap = next;
         }
-        current = current->next;
+        next = (next + 1) & mask;
     }
-
-    // Not found
-    return -1;
-}
-
-// Function to remove a client by their IP address and port
-int remove_client_by_address(struct sockaddr_in *client_address) {
-    pthread_rwlock_wrlock(&client_list.lock);
-    int result = remove_client_by_address_locked(client_address);
-    pthread_rwlock_unlock(&client_list.lock);
-    return result;
+    index->slots[gap] = NULL;
+    index->count--;
 }
 
-// Function to update a client's last active time when they send a request
-void update_client_active_time(struct sockaddr_in *client_address) {
-    pthread_rwlock_wrlock(&client_list.lock);
-    client_node_t *current = client_list.head;
-    while (current != NULL) {
-        if (current->client_address.sin_addr.s_addr == client_address->sin_addr.s_addr &&
-            current->client_address.sin_port == client_address->sin_port) {
-            current->last_active_time = time(NULL);
-            pthread_rwlock_unlock(&client_list.lock);
-            return;
+// Position of id in the set, or where it would be inserted (binary search)
+int id_set_position(const id_set_t *set, uint32_t id) {
+    int low = 0;
+    int high = set->count;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (set->ids[middle] < id) {
+            low = middle + 1;
+        } else {
+            high = middle;
         }
-        current = current->next;
     }
-    pthread_rwlock_unlock(&client_list.lock);
+    return low;
 }
 
-// Helper function to check if a client is in the muted list
-int is_client_muted_locked(client_node_t *client, const char *muted_name) {
-    muted_node_t *current = client->muted_head;
+int id_set_contains(const id_set_t *set, uint32_t id) {
+    int position = id_set_position(set, id);
+    return position < set->count && set->ids[position] == id;
+}
 
-    while (current != NULL) { // Walk through the muted list
-        if (strcmp(current->client_name, muted_name) == 0) {
-            return 1; // Found it, client is muted
+// Returns 0 if added, 1 if already in the set, -1 if out of memory
+int id_set_add(id_set_t *set, uint32_t id) {
+    int position = id_set_position(set, id);
+    if (position < set->count && set->ids[position] == id) {
+        return 1;
+    }
+    if (set->count == set->capacity) {
+        int new_capacity = set->capacity == 0 ? 4 : set->capacity * 2;
+        uint32_t *grown = (uint32_t *)realloc(set->ids, sizeof(uint32_t) * new_capacity);
+        if (grown == NULL) {
+            return -1;
         }
-        current = current->next;
+        set->ids = grown;
+        set->capacity = new_capacity;
     }
-    return 0; // Not found, client is not muted
+    memmove(&set->ids[position + 1], &set->ids[position], sizeof(uint32_t) * (set->count - position));
+    set->ids[position] = id;
+    set->count++;
+    return 0;
 }
 
-// Function to add a client to the muted list
-int add_muted_client(client_node_t *client, const char *muted_name) {
-    if (is_client_muted_locked(client, muted_name)) {
-        return -1; // Client is already muted
-    }
-
-    // Allocate memory for the new muted node
-    muted_node_t *new_muted = (muted_node_t *)malloc(sizeof(muted_node_t));
-    if (new_muted == NULL) {
-        fprintf(stderr, "Failed to allocate memory for new muted client\n");
+// Returns 0 if removed, -1 if it was not in the set
+int id_set_remove(id_set_t *set, uint32_t id) {
+    int position = id_set_position(set, id);
+    if (position >= set->count || set->ids[position] != id) {
         return -1;
     }
+    memmove(&set->ids[position], &set->ids[position + 1], sizeof(uint32_t) * (set->count - position - 1));
+    set->count--;
+    return 0;
+}
 
-    strncpy(new_muted->client_name, muted_name, MAX_NAME_LEN - 1);
-    new_muted->client_name[MAX_NAME_LEN - 1] = '\0';
-
-    // Add to the FRONT of the muted list
-    new_muted->next = client->muted_head;
-    client->muted_head = new_muted; 
-
-    printf("[DEBUG] Client '%s' muted '%s'\n", client->client_name, muted_name);
-    return 0;  // Success
+void id_set_free(id_set_t *set) {
+    free(set->ids);
+    set->ids = NULL;
+    set->count = 0;
+    set->capacity = 0;
 }
 
-// Remove a client from the muted list (unmute)
-int remove_muted_client(client_node_t *client, const char *muted_name) {
-    // Special case: removing head node
-    if (client->muted_head != NULL && 
-        strcmp(client->muted_head->client_name, muted_name) == 0) {
-        muted_node_t *to_remove = client->muted_head;
-        client->muted_head = client->muted_head->next;
-        free(to_remove);
-        printf("[DEBUG] Client '%s' unmuted '%s'\n", client->client_name, muted_name);
-        return 0;
+// Take an id, preferring one that was released earlier so ids stay small
+uint32_t id_pool_acquire(id_pool_t *pool) {
+    if (pool->free_count > 0) {
+        return pool->free_ids[--pool->free_count];
     }
-    
-    // General case: find and remove from middle/end
-    muted_node_t *current = client->muted_head;
-    while (current != NULL && current->next != NULL) {
-        if (strcmp(current->next->client_name, muted_name) == 0) {
-            muted_node_t *to_remove = current->next;
-            current->next = to_remove->next;
-            free(to_remove);
-            printf("[DEBUG] Client '%s' unmuted '%s'\n", client->client_name, muted_name);
-            return 0;
-        }
-        current = current->next;
+    return pool->next_id++;
+}
+
+void id_pool_release(id_pool_t *pool, uint32_t id) {
+    if (pool->free_count == pool->free_capacity) {
+        int new_capacity = pool->free_capacity == 0 ? 64 : pool->free_capacity * 2;
+        uint32_t *grown = (uint32_t *)realloc(pool->free_ids, sizeof(uint32_t) * new_capacity);
+        if (grown == NULL) {
+            return; // The id is simply never reused
+        }
+        pool->free_ids = grown;
+        pool->free_capacity = new_capacity;
     }
-    
-    return -1;  // Not found in muted list
+    pool->free_ids[pool->free_count++] = id;
 }
 
-// Function to clean up the mited list when the client disconnets
-void cleanup_muted_list(client_node_t *client) {
-    muted_node_t *current = client->muted_head;
-    while (current != NULL) {
-        muted_node_t *temp = current->next;
-        free(current);
-        current = temp;
+// Size class that holds a name of this length (terminator included)
+int name_store_class(size_t length) {
+    int size_class = 0;
+    while (name_store_class_sizes[size_class] < length + 1) {
+        size_class++;
     }
-    client->muted_head = NULL;
+    return size_class;
 }
 
-// Add a client to the ping tracking list (when we send a ping)
-int add_ping_tracker(struct sockaddr_in *client_address) {
-    pthread_mutex_lock(&ping_list.lock);
-    
-    // Check if already in list (shouldn't happen, but be safe)
-    ping_tracker_t *current = ping_list.head;
-    while (current != NULL) {
-        if (current->client_address.sin_addr.s_addr == client_address->sin_addr.s_addr &&
-            current->client_address.sin_port == client_address->sin_port) {
-            // Already being tracked - update ping time
-            current->ping_time = time(NULL);
-            pthread_mutex_unlock(&ping_list.lock);
-            return 0;
-        }
-        current = current->next;
+// Copy a name (truncated to MAX_NAME_LEN - 1 characters) into the name store
+// Returns NULL if memory runs out
+char *name_store_dup(str_view_t name) {
+    size_t length = name.length < MAX_NAME_LEN - 1 ? name.length : MAX_NAME_LEN - 1;
+    char *copy = (char *)slab_alloc(&name_store_slabs[name_store_class(length)]);
+    if (copy == NULL) {
+        return NULL;
     }
-    
-    // Not in list - add new tracker
-    ping_tracker_t *new_tracker = (ping_tracker_t *)malloc(sizeof(ping_tracker_t));
-    if (new_tracker == NULL) {
-        fprintf(stderr, "Failed to allocate memory for ping tracker\n");
-        pthread_mutex_unlock(&ping_list.lock);
-        return -1;
+    memcpy(copy, name.data, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+void name_store_free(char *name) {
+    if (name != NULL) {
+        slab_free(&name_store_slabs[name_store_class(strlen(name))], name);
     }
-    
-    new_tracker->client_address = *client_address;
-    new_tracker->ping_time = time(NULL);
-    new_tracker->next = ping_list.head;
-    ping_list.head = new_tracker;
-    
-    pthread_mutex_unlock(&ping_list.lock);
-    printf("[DEBUG] Added ping tracker for client at port %d\n", ntohs(client_address->sin_port));
-    return 0;
 }
 
-// Remove a client from ping tracking list (when they respond with ret-ping)
-int remove_ping_tracker(struct sockaddr_in *client_address) {
-    pthread_mutex_lock(&ping_list.lock);
-    
-    // Check if head node matches
-    if (ping_list.head != NULL) {
-        if (ping_list.head->client_address.sin_addr.s_addr == client_address->sin_addr.s_addr &&
-            ping_list.head->client_address.sin_port == client_address->sin_port) {
-            ping_tracker_t *to_remove = ping_list.head;
-            ping_list.head = ping_list.head->next;
-            free(to_remove);
-            pthread_mutex_unlock(&ping_list.lock);
-            printf("[DEBUG] Removed ping tracker for client at port %d\n", ntohs(client_address->sin_port));
-            return 0;
+// Record that the chunk holding this position of a member array changed (write lock must be held)
+void mark_chunk_dirty(dirty_chunks_t *dirty, uint32_t position) {
+    uint32_t chunk = position / SNAPSHOT_CHUNK_MEMBERS;
+    for (int i = 0; i < dirty->count; i++) {
+        if (dirty->chunks[i] == chunk) {
+            return;
         }
     }
-    
-    // Check rest of list
-    ping_tracker_t *current = ping_list.head;
-    while (current != NULL && current->next != NULL) {
-        if (current->next->client_address.sin_addr.s_addr == client_address->sin_addr.s_addr &&
-            current->next->client_address.sin_port == client_address->sin_port) {
-            ping_tracker_t *to_remove = current->next;
-            current->next = to_remove->next;
-            free(to_remove);
-            pthread_mutex_unlock(&ping_list.lock);
-            printf("[DEBUG] Removed ping tracker for client at port %d\n", ntohs(client_address->sin_port));
-            return 0;
-        }
-        current = current->next;
+    if (dirty->count == SNAPSHOT_DIRTY_MAX) {
+        dirty->all = 1;
+        return;
     }
-    
-    // Not found
-    pthread_mutex_unlock(&ping_list.lock);
-    return -1;
+    dirty->chunks[dirty->count++] = chunk;
 }
 
-// Clean up all ping trackers (called on server shutdown)
-void destroy_ping_list() {
-    pthread_mutex_lock(&ping_list.lock);
-    
-    ping_tracker_t *current = ping_list.head;
-    while (current != NULL) {
-        ping_tracker_t *temp = current->next;
-        free(current);
-        current = temp;
+int chunk_is_dirty(dirty_chunks_t *dirty, uint32_t chunk) {
+    if (dirty->all) {
+        return 1;
     }
-    
-    ping_list.head = NULL;
-    pthread_mutex_unlock(&ping_list.lock);
-    pthread_mutex_destroy(&ping_list.lock);
-    printf("[DEBUG] Ping list destroyed\n");
+    for (int i = 0; i < dirty->count; i++) {
+        if (dirty->chunks[i] == chunk) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
-void add_to_history(const char *message) {
-    
-    //we assume that message is less than the buffer size.
-    pthread_mutex_lock(&chat_history.lock);
-    
-    strcpy(chat_history.messages_history[chat_history.current_index_pointer], message);
-    chat_history.current_index_pointer = (chat_history.current_index_pointer+1) % 15;
-    
-    if (chat_history.message_count < 15){
-        chat_history.message_count += 1;
-    }
-    pthread_mutex_unlock(&chat_history.lock);
+void clear_dirty_chunks(dirty_chunks_t *dirty) {
+    dirty->count = 0;
+    dirty->all = 0;
 }
 
-int get_history(char output_buffer[15][BUFFER_SIZE]){
-    pthread_mutex_lock(&chat_history.lock);
+// Record that the snapshot chunk holding this position of client_list.hot changed (write lock must be held)
+void mark_snapshot_position_dirty(uint32_t position) {
+    client_list.snapshot_dirty = 1;
+    mark_chunk_dirty(&client_list.snapshot_dirty_chunks, position);
+}
 
-    int count = chat_history.message_count;
+// Record that somebody muted or unmuted a name (write lock must be held)
+void mark_snapshot_mutes_dirty() {
+    client_list.snapshot_dirty = 1;
+    client_list.snapshot_mutes_dirty = 1;
+}
 
-    if (count == 0){
-        pthread_mutex_unlock(&chat_history.lock);
-        return 0; //return no messages (no history)
+// Copy the muted name table into one read-only block (write lock must be held)
+// Returns -1 if memory runs out; *out is NULL when nobody is muted
+int build_snapshot_mutes_locked(snapshot_mutes_t **out) {
+    hash_index_t *by_name = &client_list.muted_names.by_name;
+    *out = NULL;
+    if (by_name->count == 0) {
+        return 0;
     }
 
-    int start_index = 0;
-
-    //here we have looping so then the oldest message is chat_hsitory.current_index_pointer
-    //if not looping is done in get history, then the oldest message is at 0
-    if (count == 15){
-        start_index = chat_history.current_index_pointer;
+    size_t capacity = 16;
+    while (capacity < by_name->count * 2) {
+        capacity *= 2;
     }
-
-    //we assume message_history already has history$ prefix with null termination and new line
-    for (int i = 0; i < count; i++){
-        int index = (start_index + i) % 15; //account for looping
-        strcpy(output_buffer[i], chat_history.messages_history[index]);
+    size_t id_bytes = 0;
+    size_t name_bytes = 0;
+    for (size_t i = 0; i < by_name->capacity; i++) {
+        muted_name_t *entry = (muted_name_t *)by_name->slots[i];
+        if (entry != NULL) {
+            id_bytes += sizeof(uint32_t) * entry->muters.count;
+            name_bytes += strlen(entry->name) + 1;
+        }
     }
 
-    pthread_mutex_unlock(&chat_history.lock);
-    return count;
-}
-
-// Parse request string into command type and content (format: "command$content")
-int parse_request(const char *request, char *command_type, char *content) {
-    const char *dollar_sign = strchr(request, '$');
-    if (dollar_sign == NULL) {
-        printf("[DEBUG] Invalid request format: no '$' delimiter found\n");
-        return -1;
-    }
-    size_t command_len = dollar_sign - request;
-    if (command_len == 0 || command_len >= BUFFER_SIZE) {
-        printf("[DEBUG] Invalid request format: command type invalid\n");
+    size_t slot_bytes = sizeof(snapshot_mutes_t) + sizeof(snapshot_muted_name_t) * capacity;
+    snapshot_mutes_t *mutes = (snapshot_mutes_t *)calloc(1, slot_bytes + id_bytes + name_bytes);
+    if (mutes == NULL) {
         return -1;
     }
-    strncpy(command_type, request, command_len);
-    command_type[command_len] = '\0';
-    size_t content_len = strlen(dollar_sign + 1);
-    if (content_len >= BUFFER_SIZE) {
-        printf("[DEBUG] Invalid request format: content too long\n");
-        return -1;
+    mutes->capacity = capacity;
+    uint32_t *ids = (uint32_t *)((char *)mutes + slot_bytes);
+    char *names = (char *)ids + id_bytes;
+
+    for (size_t i = 0; i < by_name->capacity; i++) {
+        muted_name_t *entry = (muted_name_t *)by_name->slots[i];
+        if (entry == NULL) {
+            continue;
+        }
+        size_t slot = name_hash(view_of(entry->name)) & (capacity - 1);
+        while (mutes->slots[slot].name != NULL) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        size_t name_len = strlen(entry->name) + 1;
+        memcpy(names, entry->name, name_len);
+        memcpy(ids, entry->muters.ids, sizeof(uint32_t) * entry->muters.count);
+        mutes->slots[slot].name = names;
+        mutes->slots[slot].muters = ids;
+        mutes->slots[slot].muter_count = entry->muters.count;
+        names += name_len;
+        ids += entry->muters.count;
     }
-    strncpy(content, dollar_sign + 1, BUFFER_SIZE - 1);
-    content[BUFFER_SIZE - 1] = '\0';
+    *out = mutes;
     return 0;
 }
 
-void handle_conn(const char *content, struct sockaddr_in *client_address, int socket_descriptor){
-    //trim(content);
-    //Assume that content is already trimmed -> could be done in the route request function
-    
-    size_t len = strlen(content);
-    
-    if (len == 0 || len >= MAX_NAME_LEN){
-        char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, "Error$ No name or too long of a name. Expected 'conn$ [NAME]'\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+// Find a muted name in a snapshot (NULL if nobody mutes it)
+const snapshot_muted_name_t *snapshot_find_muted_name(snapshot_mutes_t *mutes, const char *name) {
+    if (mutes == NULL) {
+        return NULL;
     }
-
+    size_t slot = name_hash(view_of(name)) & (mutes->capacity - 1);
+    while (mutes->slots[slot].name != NULL) {
+        if (strcmp(mutes->slots[slot].name, name) == 0) {
+            return &mutes->slots[slot];
+        }
+        slot = (slot + 1) & (mutes->capacity - 1);
+    }
+    return NULL;
+}
+
+void free_client_snapshot(client_snapshot_t *snapshot, int free_shared) {
+    if (snapshot == NULL) {
+        return;
+    }
+    if (free_shared) {
+        for (uint32_t c = 0; c < snapshot->chunk_count; c++) {
+            free(snapshot->chunks[c]);
+        }
+        free(snapshot->mutes);
+    }
+    free(snapshot);
+}
+
+// Publish a new snapshot with the changes made under the current write lock (write lock must be held)
+// Unchanged chunks and the mute table are shared with the previous snapshot; replaced parts are retired
+// and freed once no broadcast can still be reading them. If memory runs out the old snapshot stays
+// published and the changes are retried at the next unlock
+void publish_client_snapshot_locked() {
+    client_snapshot_t *old = atomic_load_explicit(&client_list.snapshot, memory_order_relaxed);
+    uint32_t old_chunk_count = old != NULL ? old->chunk_count : 0;
+    uint32_t chunk_count = (client_list.count + SNAPSHOT_CHUNK_MEMBERS - 1) / SNAPSHOT_CHUNK_MEMBERS;
+
+    client_snapshot_t *fresh = (client_snapshot_t *)malloc(sizeof(client_snapshot_t) + sizeof(snapshot_chunk_t *) * chunk_count);
+    if (fresh == NULL) {
+        fprintf(stderr, "Failed to allocate client snapshot\n");
+        return;
+    }
+    fresh->member_count = client_list.count;
+    fresh->chunk_count = 0;
+    fresh->mutes = old != NULL ? old->mutes : NULL;
+
+    if (client_list.snapshot_mutes_dirty && build_snapshot_mutes_locked(&fresh->mutes) != 0) {
+        free(fresh);
+        fprintf(stderr, "Failed to allocate client snapshot\n");
+        return;
+    }
+
+    for (uint32_t c = 0; c < chunk_count; c++) {
+        if (c < old_chunk_count && !chunk_is_dirty(&client_list.snapshot_dirty_chunks, c)) {
+            fresh->chunks[c] = old->chunks[c];
+            continue;
+        }
+        snapshot_chunk_t *chunk = (snapshot_chunk_t *)malloc(sizeof(snapshot_chunk_t));
+        if (chunk == NULL) {
+            // Undo: free only what was built for this snapshot
+            for (uint32_t built = 0; built < c; built++) {
+                if (built >= old_chunk_count || fresh->chunks[built] != old->chunks[built]) {
+                    free(fresh->chunks[built]);
+                }
+            }
+            if (client_list.snapshot_mutes_dirty) {
+                free(fresh->mutes);
+            }
+            free(fresh);
+            fprintf(stderr, "Failed to allocate client snapshot\n");
+            return;
+        }
+        uint32_t first = c * SNAPSHOT_CHUNK_MEMBERS;
+        for (uint32_t i = 0; i < SNAPSHOT_CHUNK_MEMBERS && first + i < client_list.count; i++) {
+            chunk->members[i].client_address = client_list.hot[first + i].client_address;
+            chunk->members[i].client_id = client_list.hot[first + i].client_id;
+            chunk->members[i].wire_format = client_list.hot[first + i].wire_format;
+        }
+        fresh->chunks[c] = chunk;
+    }
+    fresh->chunk_count = chunk_count;
+
+    atomic_store_explicit(&client_list.snapshot, fresh, memory_order_release);
+
+    // Retire whatever the new snapshot no longer shares
+    if (old != NULL) {
+        for (uint32_t c = 0; c < old_chunk_count; c++) {
+            if (c >= chunk_count || fresh->chunks[c] != old->chunks[c]) {
+                epoch_retire(old->chunks[c], free);
+            }
+        }
+        if (fresh->mutes != old->mutes) {
+            epoch_retire(old->mutes, free);
+        }
+        epoch_retire(old, free);
+    }
+
+    client_list.snapshot_dirty = 0;
+    client_list.snapshot_mutes_dirty = 0;
+    clear_dirty_chunks(&client_list.snapshot_dirty_chunks);
+
+    epoch_reclaim();
+}
+
+// Free functions for epoch_retire
+void free_stored_name(void *name) {
+    name_store_free((char *)name);
+}
+
+void free_client_node(void *node) {
+    name_store_free(((client_node_t *)node)->client_name);
+    slab_free(&client_slab, node);
+}
+
+//Initialize the client list
+void init_client_list() {
+    client_list.hot = NULL;
+    client_list.nodes = NULL;
+    client_list.count = 0;
+    client_list.capacity = 0;
+    client_list.by_id = NULL;
+    client_list.by_id_capacity = 0;
+    client_list.next_generation = 0;
+    atomic_init(&client_list.snapshot, NULL);
+    clear_dirty_chunks(&client_list.snapshot_dirty_chunks);
+    client_list.snapshot_mutes_dirty = 0;
+
+    if (init_hash_index(&client_list.address_index, HASH_INDEX_INITIAL_CAPACITY, INDEX_BY_ADDRESS) != 0 ||
+        init_hash_index(&client_list.name_index, HASH_INDEX_INITIAL_CAPACITY, INDEX_BY_NAME) != 0 ||
+        init_hash_index(&client_list.muted_names.by_name, HASH_INDEX_INITIAL_CAPACITY, INDEX_BY_MUTED_NAME) != 0 ||
+        init_hash_index(&client_list.room_index, HASH_INDEX_INITIAL_CAPACITY, INDEX_BY_ROOM_NAME) != 0) {
+        fprintf(stderr, "Failed to allocate client indexes\n");
+        exit(1);
+    }
+
+    // Every client starts in the lobby, which is never deleted and keeps the numbered chat history
+    client_list.dirty_rooms = NULL;
+    client_list.room_count = 0;
+    client_list.lobby = create_room_locked(view_of(LOBBY_ROOM_NAME));
+    if (client_list.lobby == NULL) {
+        fprintf(stderr, "Failed to allocate the lobby\n");
+        exit(1);
+    }
+    client_list.lobby->history = &chat_history;
+
+    //Initialize the read-write lock
+    int rc = pthread_rwlock_init(&client_list.lock, NULL);
+
+    if (rc != 0) {
+        fprintf(stderr, "Failed to initialize reader-writer lock\n");
+        exit(1);
+    }
+
+    // Broadcasts always find a snapshot, even before the first client connects
+    client_list.snapshot_dirty = 1;
+    publish_client_snapshot_locked();
+    publish_room_snapshots_locked();
+    if (atomic_load(&client_list.snapshot) == NULL || atomic_load(&client_list.lobby->snapshot) == NULL) {
+        exit(1);
+    }
+    LOG_INFO("Client list initialized\n");
+}
+
+// Set up an empty history keeping up to depth messages
+void init_history(chat_history_t *history, size_t depth) {
+    history->head = NULL;
+    history->tail = NULL;
+    history->head_offset = 0;
+    history->first_seq = 1;
+    history->next_seq = 1;
+    history->depth = depth;
+    history->payload_bytes = 0;
+    history->block_count = 0;
+    history->log = NULL;
+    //initialise the lock
+    pthread_mutex_init(&history->lock, NULL);
+}
+
+// Free the blocks still in the chain (retired ones are freed by epoch_destroy)
+void destroy_history(chat_history_t *history) {
+    shared_mutex_lock(&history->lock);
+    history_block_t *block = history->head;
+    while (block != NULL) {
+        history_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    history->head = NULL;
+    history->tail = NULL;
+    history->block_count = 0;
+    if (history->log != NULL) {
+        history_log_close(history->log);
+        history->log = NULL;
+    }
+    shared_mutex_unlock(&history->lock);
+    pthread_mutex_destroy(&history->lock);
+}
+
+// Rooms other than the lobby are created by the first join$ and deleted at the unlock after their last
+// member leaves. All of these need the client list write lock (find_room_locked needs any lock)
+
+room_t *find_room_locked(str_view_t name) {
+    return (room_t *)hash_index_find_name(&client_list.room_index, name);
+}
+
+// Queue the room for client_list_unlock, which publishes its snapshot or deletes it if it is empty
+void mark_room_dirty_locked(room_t *room) {
+    if (!room->dirty) {
+        room->dirty = 1;
+        room->next_dirty = client_list.dirty_rooms;
+        client_list.dirty_rooms = room;
+    }
+}
+
+void mark_room_position_dirty_locked(room_t *room, uint32_t position) {
+    mark_chunk_dirty(&room->dirty_chunks, position);
+    mark_room_dirty_locked(room);
+}
+
+// Returns NULL if memory runs out
+room_t *create_room_locked(str_view_t name) {
+    room_t *room = (room_t *)calloc(1, sizeof(room_t));
+    if (room == NULL) {
+        return NULL;
+    }
+    room->name = name_store_dup(name);
+    if (room->name == NULL || hash_index_insert(&client_list.room_index, room) != 0) {
+        name_store_free(room->name);
+        free(room);
+        return NULL;
+    }
+    atomic_init(&room->snapshot, NULL);
+    init_history(&room->own_history, server_config.history_depth);
+    room->history = &room->own_history;
+    client_list.room_count++;
+    mark_room_dirty_locked(room);
+    return room;
+}
+
+void free_room_snapshot(room_snapshot_t *snapshot, int free_shared) {
+    if (snapshot == NULL) {
+        return;
+    }
+    if (free_shared) {
+        for (uint32_t c = 0; c < snapshot->chunk_count; c++) {
+            free(snapshot->chunks[c]);
+        }
+    }
+    free(snapshot);
+}
+
+// Free function for epoch_retire (a say$ that loaded the room before it was deleted may still append to it)
+void free_room(void *arg) {
+    room_t *room = (room_t *)arg;
+    free_room_snapshot(atomic_load(&room->snapshot), 1);
+    destroy_history(&room->own_history);
+    name_store_free(room->name);
+    free(room->members);
+    free(room);
+}
+
+// Make sure one more member fits, so moving a client can no longer fail halfway
+// Returns -1 if memory runs out
+int reserve_room_member_locked(room_t *room) {
+    if (room->member_count < room->member_capacity) {
+        return 0;
+    }
+    uint32_t new_capacity = room->member_capacity == 0 ? 16 : room->member_capacity * 2;
+    snapshot_member_t *grown = (snapshot_member_t *)realloc(room->members, sizeof(snapshot_member_t) * new_capacity);
+    if (grown == NULL) {
+        return -1;
+    }
+    room->members = grown;
+    room->member_capacity = new_capacity;
+    return 0;
+}
+
+// Append a client to a room with a member slot reserved, and make it the client's room
+void add_room_member_locked(room_t *room, client_node_t *client) {
+    client->room_position = room->member_count++;
+    snapshot_member_t *member = &room->members[client->room_position];
+    member->client_address = client->client_address;
+    member->client_id = client->client_id;
+    member->wire_format = (uint8_t)client->wire_format;
+    atomic_store_explicit(&client->room, room, memory_order_release);
+    mark_room_position_dirty_locked(room, client->room_position);
+}
+
+// Take a client out of its room, moving the room's last member into the gap
+// client->room keeps pointing at the old room until the client is added to another one
+void remove_room_member_locked(client_node_t *client) {
+    room_t *room = atomic_load_explicit(&client->room, memory_order_relaxed);
+    uint32_t last = room->member_count - 1;
+    if (client->room_position != last) {
+        room->members[client->room_position] = room->members[last];
+        client_list.by_id[room->members[last].client_id]->room_position = client->room_position;
+        mark_room_position_dirty_locked(room, client->room_position);
+    }
+    room->member_count--;
+    mark_room_position_dirty_locked(room, last);
+}
+
+// Move a client into another room. Returns -1 (client stays where it was) if memory runs out
+int move_client_to_room_locked(client_node_t *client, room_t *room) {
+    if (reserve_room_member_locked(room) != 0) {
+        return -1;
+    }
+    remove_room_member_locked(client);
+    add_room_member_locked(room, client);
+    return 0;
+}
+
+// Publish a room's members like publish_client_snapshot_locked publishes the client list: chunks that did
+// not change are shared with the old snapshot, and whatever is replaced is retired through the epoch
+// Returns -1 (old snapshot stays published) if memory runs out
+int publish_room_snapshot_locked(room_t *room) {
+    room_snapshot_t *old = atomic_load_explicit(&room->snapshot, memory_order_relaxed);
+    uint32_t old_chunk_count = old != NULL ? old->chunk_count : 0;
+    uint32_t chunk_count = (room->member_count + SNAPSHOT_CHUNK_MEMBERS - 1) / SNAPSHOT_CHUNK_MEMBERS;
+
+    room_snapshot_t *fresh = (room_snapshot_t *)malloc(sizeof(room_snapshot_t) + sizeof(snapshot_chunk_t *) * chunk_count);
+    if (fresh == NULL) {
+        return -1;
+    }
+    fresh->member_count = room->member_count;
+
+    for (uint32_t c = 0; c < chunk_count; c++) {
+        if (c < old_chunk_count && !chunk_is_dirty(&room->dirty_chunks, c)) {
+            fresh->chunks[c] = old->chunks[c];
+            continue;
+        }
+        snapshot_chunk_t *chunk = (snapshot_chunk_t *)malloc(sizeof(snapshot_chunk_t));
+        if (chunk == NULL) {
+            for (uint32_t built = 0; built < c; built++) {
+                if (built >= old_chunk_count || fresh->chunks[built] != old->chunks[built]) {
+                    free(fresh->chunks[built]);
+                }
+            }
+            free(fresh);
+            return -1;
+        }
+        uint32_t first = c * SNAPSHOT_CHUNK_MEMBERS;
+        uint32_t in_chunk = room->member_count - first;
+        if (in_chunk > SNAPSHOT_CHUNK_MEMBERS) {
+            in_chunk = SNAPSHOT_CHUNK_MEMBERS;
+        }
+        memcpy(chunk->members, &room->members[first], sizeof(snapshot_member_t) * in_chunk);
+        fresh->chunks[c] = chunk;
+    }
+    fresh->chunk_count = chunk_count;
+
+    atomic_store_explicit(&room->snapshot, fresh, memory_order_release);
+
+    if (old != NULL) {
+        for (uint32_t c = 0; c < old_chunk_count; c++) {
+            if (c >= chunk_count || fresh->chunks[c] != old->chunks[c]) {
+                epoch_retire(old->chunks[c], free);
+            }
+        }
+        epoch_retire(old, free);
+    }
+    clear_dirty_chunks(&room->dirty_chunks);
+    return 0;
+}
+
+// Publish every room changed in this write section, and delete the ones left empty (lobby excepted)
+void publish_room_snapshots_locked() {
+    room_t *room = client_list.dirty_rooms;
+    client_list.dirty_rooms = NULL;
+    while (room != NULL) {
+        room_t *next = room->next_dirty;
+        room->dirty = 0;
+        room->next_dirty = NULL;
+        if (room->member_count == 0 && room != client_list.lobby) {
+            hash_index_remove(&client_list.room_index, room);
+            client_list.room_count--;
+            epoch_retire(room, free_room);
+        } else if (publish_room_snapshot_locked(room) != 0) {
+            fprintf(stderr, "Failed to allocate snapshot of room '%s'\n", room->name);
+            mark_room_dirty_locked(room); // Retried at the next unlock
+        }
+        room = next;
+    }
+    epoch_reclaim();
+}
+
+// Initialize the request queue and preallocate all of its slots
+void init_request_queue(request_queue_t *queue, int capacity, overflow_policy_t overflow_policy) {
+    queue->slots = (request_handler_t *)calloc(capacity, sizeof(request_handler_t));
+    if (queue->slots == NULL) {
+        fprintf(stderr, "Failed to allocate request queue slots\n");
+        exit(1);
+    }
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->overflow_policy = overflow_policy;
+    queue->enqueued = 0;
+    queue->dropped_newest = 0;
+    queue->dropped_oldest = 0;
+    queue->batches = 0;
+
+    if (pthread_mutex_init(&queue->lock, NULL) != 0 || pthread_cond_init(&queue->not_empty, NULL) != 0) {
+        fprintf(stderr, "Failed to initialize request queue lock\n");
+        exit(1);
+    }
+    LOG_INFO("Request queue initialized (%d slots)\n", capacity);
+}
+
+void destroy_request_queue(request_queue_t *queue) {
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+// Copy a received datagram into the next free slot (queue lock must be held)
+// Returns 0 if queued, -1 if the request was dropped because the queue was full
+int request_queue_push_locked(request_queue_t *queue, const char *request, int len, struct sockaddr_in *client_address, int socket_descriptor) {
+    if (queue->count == queue->capacity) {
+        if (queue->overflow_policy == OVERFLOW_DROP_NEWEST) {
+            queue->dropped_newest++;
+            return -1;
+        }
+        // Drop-oldest: the oldest slot gets reused for this request
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        queue->dropped_oldest++;
+    }
+
+    int tail = (queue->head + queue->count) % queue->capacity;
+    request_handler_t *slot = &queue->slots[tail];
+    memcpy(slot->request, request, len);
+    slot->request[len] = '\0';
+    slot->request_length = len;
+    slot->client_address = *client_address;
+    slot->socket_descriptor = socket_descriptor;
+
+    queue->count++;
+    queue->enqueued++;
+    return 0;
+}
+
+// Push a whole batch of datagrams under a single lock acquisition
+// Returns the number of datagrams that were dropped because the queue was full
+int request_queue_push_batch(request_queue_t *queue, char (*requests)[BUFFER_SIZE], int *lengths, struct sockaddr_in *client_addresses, int count, int socket_descriptor) {
+    int dropped = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    for (int i = 0; i < count; i++) {
+        if (request_queue_push_locked(queue, requests[i], lengths[i], &client_addresses[i], socket_descriptor) != 0) {
+            dropped++;
+        }
+    }
+    queue->batches++;
+
+    // Wake as many workers as there are new requests
+    if (count > 1) {
+        pthread_cond_broadcast(&queue->not_empty);
+    } else {
+        pthread_cond_signal(&queue->not_empty);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return dropped;
+}
+
+// Block until a request is available, then copy it out so the slot can be reused straight away
+void request_queue_pop(request_queue_t *queue, request_handler_t *out) {
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->count == 0) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+
+    request_handler_t *slot = &queue->slots[queue->head];
+    memcpy(out->request, slot->request, slot->request_length + 1);
+    out->request_length = slot->request_length;
+    out->client_address = slot->client_address;
+    out->socket_descriptor = slot->socket_descriptor;
+
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Initialize the object slabs
+void init_slabs() {
+    if (slab_init(&client_slab, "client", sizeof(client_node_t)) != 0 ||
+        slab_init(&muted_name_slab, "muted-name", sizeof(muted_name_t)) != 0 ||
+        slab_init(&client_timer_slab, "client-timer", sizeof(client_timer_t)) != 0 ||
+        slab_init(&outbound_slab, "outbound", sizeof(outbound_message_t)) != 0) {
+        fprintf(stderr, "Failed to initialize object slabs\n");
+        exit(1);
+    }
+    for (int i = 0; i < NAME_STORE_CLASSES; i++) {
+        if (slab_init(&name_store_slabs[i], "name", name_store_class_sizes[i]) != 0) {
+            fprintf(stderr, "Failed to initialize name store\n");
+            exit(1);
+        }
+    }
+    LOG_INFO("Object slabs initialized\n");
+}
+
+// Release every slab's memory (called on server shutdown, after the lists are destroyed)
+void destroy_slabs() {
+    slab_destroy(&client_slab);
+    slab_destroy(&muted_name_slab);
+    slab_destroy(&client_timer_slab);
+    slab_destroy(&outbound_slab);
+    for (int i = 0; i < NAME_STORE_CLASSES; i++) {
+        slab_destroy(&name_store_slabs[i]);
+    }
+    LOG_INFO("Object slabs destroyed\n");
+}
+
+// Initialize the timer wheel (the coarse clock must already be set)
+void init_timer_wheel() {
+    memset(client_timers.slots, 0, sizeof(client_timers.slots));
+    client_timers.current_tick = coarse_now();
+    client_timers.pending = 0;
+    int rc = pthread_mutex_init(&client_timers.lock, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "Failed to initialize timer wheel mutex\n");
+        exit(1);
+    }
+    LOG_INFO("Timer wheel initialized\n");
+}
+
+// Function to clean up the client list (Called on server shutdown)
+void destroy_client_list() {
+    // Acquire the write lock
+    client_list_write_lock();
+
+    //Free all the client nodes
+    for (uint32_t i = 0; i < client_list.count; i++) {
+        client_node_t *current = client_list.nodes[i];
+        cleanup_muted_list(current);  // Clean up muted list first
+        name_store_free(current->client_name);
+        slab_free(&client_slab, current);
+    }
+
+    client_list.count = 0;
+    client_list.capacity = 0;
+    free_client_snapshot(atomic_load(&client_list.snapshot), 1);
+    atomic_store(&client_list.snapshot, NULL);
+    client_list.snapshot_dirty = 0;
+    free(client_list.hot);
+    client_list.hot = NULL;
+    free(client_list.nodes);
+    client_list.nodes = NULL;
+    free(client_list.by_id);
+    client_list.by_id = NULL;
+    client_list.by_id_capacity = 0;
+    free(client_list.address_index.slots);
+    client_list.address_index.slots = NULL;
+    free(client_list.name_index.slots);
+    client_list.name_index.slots = NULL;
+    free(client_list.muted_names.by_name.slots);
+    client_list.muted_names.by_name.slots = NULL;
+    free(client_list.muted_names.by_id);
+    client_list.muted_names.by_id = NULL;
+    for (size_t i = 0; i < client_list.room_index.capacity; i++) {
+        if (client_list.room_index.slots[i] != NULL) {
+            free_room(client_list.room_index.slots[i]);
+        }
+    }
+    free(client_list.room_index.slots);
+    client_list.room_index.slots = NULL;
+    client_list.dirty_rooms = NULL;
+    client_list.lobby = NULL;
+    client_list.room_count = 0;
+    free(client_list.client_ids.free_ids);
+    free(client_list.muted_names.name_ids.free_ids);
+
+    // Release the write lock
+    client_list_unlock();
+
+    // Destroy the lock itself
+    pthread_rwlock_destroy(&client_list.lock);
+
+    // Free removed clients and old snapshots that were still waiting for readers
+    epoch_destroy();
+
+    LOG_INFO("Client list destroyed\n");
+}
+
+// Function to add a new client to the list
+// Returns NULL if memory runs out, a client is already connected from this address or the name is taken
+// (both checks happen under the write lock, so two clients racing for one name cannot both get it)
+client_node_t *add_client(const char *client_name, struct sockaddr_in *client_address, int is_admin, wire_format_t wire_format) {
+    // Allocate memory for the new client node and its timer
+    client_node_t *new_node = (client_node_t *)slab_alloc(&client_slab);
+    client_timer_t *timer = (client_timer_t *)slab_alloc(&client_timer_slab);
+
+    if (new_node == NULL || timer == NULL) {
+        fprintf(stderr, "Failed to allocate memory for new client\n");
+        slab_free(&client_slab, new_node);
+        slab_free(&client_timer_slab, timer);
+        return NULL;
+    }
+
+    // Initialize mute set to empty
+    new_node->muted_names.ids = NULL;
+    new_node->muted_names.count = 0;
+    new_node->muted_names.capacity = 0;
+
+    // Copy the client name into the name store (truncated to MAX_NAME_LEN - 1 characters)
+    new_node->client_name = name_store_dup(view_of(client_name));
+    if (new_node->client_name == NULL) {
+        slab_free(&client_slab, new_node);
+        slab_free(&client_timer_slab, timer);
+        return NULL;
+    }
+
+    // Copy the client address into the node
+    new_node->client_address = *client_address;
+
+    // Set admin flag
+    new_node->is_admin = is_admin;
+    new_node->wire_format = wire_format;
+
+    // Acquire the write lock
+    client_list_write_lock();
+
+    // The address is the client's identity, so only one client per address, and names are unique
+    if (hash_index_find_address(&client_list.address_index, client_address) != NULL ||
+        hash_index_find_name(&client_list.name_index, view_of(new_node->client_name)) != NULL) {
+        client_list_unlock();
+        name_store_free(new_node->client_name);
+        slab_free(&client_slab, new_node);
+        slab_free(&client_timer_slab, timer);
+        return NULL;
+    }
+    if (hash_index_insert(&client_list.address_index, new_node) != 0) {
+        client_list_unlock();
+        name_store_free(new_node->client_name);
+        slab_free(&client_slab, new_node);
+        slab_free(&client_timer_slab, timer);
+        return NULL;
+    }
+    if (hash_index_insert(&client_list.name_index, new_node) != 0) {
+        hash_index_remove(&client_list.address_index, new_node);
+        client_list_unlock();
+        name_store_free(new_node->client_name);
+        slab_free(&client_slab, new_node);
+        slab_free(&client_timer_slab, timer);
+        return NULL;
+    }
+
+    // Make room in the id table for whichever id the pool hands out (at most next_id)
+    if (client_list.client_ids.next_id >= client_list.by_id_capacity) {
+        uint32_t new_capacity = client_list.by_id_capacity == 0 ? 64 : client_list.by_id_capacity * 2;
+        client_node_t **grown = (client_node_t **)realloc(client_list.by_id, sizeof(client_node_t *) * new_capacity);
+        if (grown == NULL) {
+            hash_index_remove(&client_list.address_index, new_node);
+            hash_index_remove(&client_list.name_index, new_node);
+            client_list_unlock();
+            name_store_free(new_node->client_name);
+            slab_free(&client_slab, new_node);
+            slab_free(&client_timer_slab, timer);
+            return NULL;
+        }
+        memset(grown + client_list.by_id_capacity, 0, sizeof(client_node_t *) * (new_capacity - client_list.by_id_capacity));
+        client_list.by_id = grown;
+        client_list.by_id_capacity = new_capacity;
+    }
+
+    // Make room for the hot record at the end of the array
+    if (client_list.count == client_list.capacity) {
+        uint32_t new_capacity = client_list.capacity == 0 ? 64 : client_list.capacity * 2;
+        client_hot_t *grown_hot = (client_hot_t *)realloc(client_list.hot, sizeof(client_hot_t) * new_capacity);
+        if (grown_hot != NULL) {
+            client_list.hot = grown_hot;
+        }
+        client_node_t **grown_nodes = (client_node_t **)realloc(client_list.nodes, sizeof(client_node_t *) * new_capacity);
+        if (grown_nodes != NULL) {
+            client_list.nodes = grown_nodes;
+        }
+        if (grown_hot == NULL || grown_nodes == NULL) {
+            hash_index_remove(&client_list.address_index, new_node);
+            hash_index_remove(&client_list.name_index, new_node);
+            client_list_unlock();
+            name_store_free(new_node->client_name);
+            slab_free(&client_slab, new_node);
+            slab_free(&client_timer_slab, timer);
+            return NULL;
+        }
+        client_list.capacity = new_capacity;
+    }
+
+    // Make room in the lobby, which every client joins
+    if (reserve_room_member_locked(client_list.lobby) != 0) {
+        hash_index_remove(&client_list.address_index, new_node);
+        hash_index_remove(&client_list.name_index, new_node);
+        client_list_unlock();
+        name_store_free(new_node->client_name);
+        slab_free(&client_slab, new_node);
+        slab_free(&client_timer_slab, timer);
+        return NULL;
+    }
+
+    new_node->client_id = id_pool_acquire(&client_list.client_ids);
+    new_node->generation = client_list.next_generation++;
+    client_list.by_id[new_node->client_id] = new_node;
+
+    // Append the hot record (last active time starts at the current time)
+    new_node->hot_index = client_list.count;
+    client_hot_t *hot = &client_list.hot[new_node->hot_index];
+    hot->client_address = *client_address;
+    atomic_store_explicit(&hot->last_active_time, coarse_now(), memory_order_relaxed);
+    hot->client_id = new_node->client_id;
+    hot->wire_format = wire_format;
+    client_list.nodes[new_node->hot_index] = new_node;
+    client_list.count++;
+    mark_snapshot_position_dirty(new_node->hot_index);
+    add_room_member_locked(client_list.lobby, new_node);
+
+    // Start the inactivity timer
+    timer->client_id = new_node->client_id;
+    timer->generation = new_node->generation;
+    timer->kind = TIMER_INACTIVITY;
+    timer->armed_time = coarse_now();
+    timer->deadline = timer->armed_time + INACTIVITY_THRESHOLD;
+
+    client_list_unlock();
+
+    timer_wheel_schedule(&client_timers, timer);
+
+    LOG_DEBUG("Client %s added to the list\n", client_name);
+    return new_node;
+}
+
+// Helper function to remove a node from the client arrays and the indexes and free it (write lock must be held)
+// The node is freed through epoch_retire, so a handler that looked it up before the removal can keep using it
+void remove_client_node_locked(client_node_t *to_remove) {
+    // Move the last client's records into the freed position
+    uint32_t last = client_list.count - 1;
+    if (to_remove->hot_index != last) {
+        client_list.hot[to_remove->hot_index] = client_list.hot[last];
+        client_list.nodes[to_remove->hot_index] = client_list.nodes[last];
+        client_list.nodes[to_remove->hot_index]->hot_index = to_remove->hot_index;
+        mark_snapshot_position_dirty(to_remove->hot_index);
+    }
+    client_list.count--;
+    mark_snapshot_position_dirty(last);
+
+    hash_index_remove(&client_list.address_index, to_remove);
+    hash_index_remove(&client_list.name_index, to_remove);
+    remove_room_member_locked(to_remove);
+
+    // Clean up mutes before freeing
+    cleanup_muted_list(to_remove);
+    client_list.by_id[to_remove->client_id] = NULL;
+    id_pool_release(&client_list.client_ids, to_remove->client_id);
+    epoch_retire(to_remove, free_client_node);
+}
+
+// Helper function to find a client by name while lock is already held
+client_node_t *find_client_by_name_locked(str_view_t client_name) {
+    return (client_node_t *)hash_index_find_name(&client_list.name_index, client_name);
+}
+
+// Helper function to change a client's name while the write lock is held
+// The name index is keyed on the name, so the node comes out under its old name and goes back in under the new one
+// Returns -1 (name unchanged) if memory runs out
+int rename_client_locked(client_node_t *client, str_view_t new_name) {
+    char *stored_name = name_store_dup(new_name);
+    if (stored_name == NULL) {
+        return -1;
+    }
+    hash_index_remove(&client_list.name_index, client);
+    // Handlers that read the old name before the rename may still be using it
+    epoch_retire(client->client_name, free_stored_name);
+    client->client_name = stored_name;
+    // Cannot fail: the node was just removed, so the table has room without growing
+    hash_index_insert(&client_list.name_index, client);
+    return 0;
+}
+
+// Function to find a client by their chat name
+client_node_t *find_client_by_name(str_view_t client_name) {
+    // Acquire the read lock
+    client_list_read_lock();
+
+    // Find the client by name
+    client_node_t *result = find_client_by_name_locked(client_name);
+
+    client_list_unlock();
+
+    return result;
+}
+
+// Helper function to find a client by client_id while lock is already held
+client_node_t *find_client_by_id_locked(uint32_t client_id) {
+    if (client_id >= client_list.by_id_capacity) {
+        return NULL;
+    }
+    return client_list.by_id[client_id];
+}
+
+// Helper function to find client by address when lock is already held
+client_node_t *find_client_by_address_locked(struct sockaddr_in *client_address) {
+    return hash_index_find_address(&client_list.address_index, client_address);
+}
+
+// Function to find a client by their IP address and port number
+client_node_t *find_client_by_address(struct sockaddr_in *client_address) {
+    client_list_read_lock();
+    client_node_t *result = find_client_by_address_locked(client_address);
+    client_list_unlock();
+    return result;
+}
+
+// Function to remove a client from the list by their name
+int remove_client_by_name(const char *client_name) {
+    client_list_write_lock();
+    
+    client_node_t *to_remove = find_client_by_name_locked(view_of(client_name));
+    if (to_remove == NULL) {
+        // If we get here, we didn't find the client to remove
+        client_list_unlock();
+        LOG_DEBUG("Client '%s' not found for removal\n", client_name);
+        return -1;  // Not found
+    }
+
+    remove_client_node_locked(to_remove);
+
+    client_list_unlock();
+    LOG_DEBUG("Client '%s' removed from list\n", client_name);
+    return 0;
+}
+
+// Helper function to remove client by address when lock is already held
+int remove_client_by_address_locked(struct sockaddr_in *client_address) {
+    client_node_t *to_remove = find_client_by_address_locked(client_address);
+    if (to_remove == NULL) {
+        return -1; // Not found
+    }
+    remove_client_node_locked(to_remove);
+    return 0;
+}
+
+// Function to remove a client by their IP address and port
+int remove_client_by_address(struct sockaddr_in *client_address) {
+    client_list_write_lock();
+    int result = remove_client_by_address_locked(client_address);
+    client_list_unlock();
+    return result;
+}
+
+// Function to update a client's last active time when they send a request
+// The timestamp is atomic, so a read lock is enough: it only keeps the hot record from moving
+// (removals and array growth take the write lock). Nothing is written if the clock has not ticked
+// since the client's last request, so back-to-back requests do not keep dirtying the cache line
+void update_client_active_time(struct sockaddr_in *client_address) {
+    time_t now = coarse_now();
+    client_list_read_lock();
+    client_node_t *current = find_client_by_address_locked(client_address);
+    if (current != NULL) {
+        _Atomic time_t *last_active_time = &client_list.hot[current->hot_index].last_active_time;
+        if (atomic_load_explicit(last_active_time, memory_order_relaxed) != now) {
+            atomic_store_explicit(last_active_time, now, memory_order_relaxed);
+        }
+    }
+    client_list_unlock();
+}
+
+// Helper function to find the entry for a muted name (client list lock must be held)
+// Returns NULL if nobody has muted this name
+muted_name_t *find_muted_name_locked(str_view_t muted_name) {
+    return (muted_name_t *)hash_index_find_name(&client_list.muted_names.by_name, muted_name);
+}
+
+// Create the entry for a name the first time somebody mutes it (write lock must be held)
+muted_name_t *create_muted_name_locked(str_view_t muted_name) {
+    muted_name_table_t *table = &client_list.muted_names;
+
+    muted_name_t *entry = (muted_name_t *)slab_alloc(&muted_name_slab);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->name = name_store_dup(muted_name);
+    if (entry->name == NULL) {
+        slab_free(&muted_name_slab, entry);
+        return NULL;
+    }
+    entry->muters.ids = NULL;
+    entry->muters.count = 0;
+    entry->muters.capacity = 0;
+    entry->name_id = id_pool_acquire(&table->name_ids);
+
+    // Make room in the id -> entry table
+    if (entry->name_id >= table->by_id_capacity) {
+        uint32_t new_capacity = table->by_id_capacity == 0 ? 64 : table->by_id_capacity * 2;
+        while (new_capacity <= entry->name_id) {
+            new_capacity *= 2;
+        }
+        muted_name_t **grown = (muted_name_t **)realloc(table->by_id, sizeof(muted_name_t *) * new_capacity);
+        if (grown == NULL) {
+            id_pool_release(&table->name_ids, entry->name_id);
+            name_store_free(entry->name);
+            slab_free(&muted_name_slab, entry);
+            return NULL;
+        }
+        table->by_id = grown;
+        table->by_id_capacity = new_capacity;
+    }
+
+    if (hash_index_insert(&table->by_name, entry) != 0) {
+        id_pool_release(&table->name_ids, entry->name_id);
+        name_store_free(entry->name);
+        slab_free(&muted_name_slab, entry);
+        return NULL;
+    }
+    table->by_id[entry->name_id] = entry;
+    return entry;
+}
+
+// Delete a muted name entry once the last muter is gone (write lock must be held)
+void release_muted_name_locked(muted_name_t *entry) {
+    if (entry->muters.count > 0) {
+        return;
+    }
+    muted_name_table_t *table = &client_list.muted_names;
+    hash_index_remove(&table->by_name, entry);
+    table->by_id[entry->name_id] = NULL;
+    id_pool_release(&table->name_ids, entry->name_id);
+    id_set_free(&entry->muters);
+    name_store_free(entry->name);
+    slab_free(&muted_name_slab, entry);
+}
+
+// Helper function to check if a client has muted a name
+int is_client_muted_locked(client_node_t *client, str_view_t muted_name) {
+    muted_name_t *entry = find_muted_name_locked(muted_name);
+    if (entry == NULL) {
+        return 0; // Nobody has muted this name
+    }
+    return id_set_contains(&client->muted_names, entry->name_id);
+}
+
+// Function to add a name to a client's mutes (write lock must be held)
+int add_muted_client(client_node_t *client, str_view_t muted_name) {
+    muted_name_t *entry = find_muted_name_locked(muted_name);
+    if (entry == NULL) {
+        entry = create_muted_name_locked(muted_name);
+        if (entry == NULL) {
+            fprintf(stderr, "Failed to allocate memory for new muted client\n");
+            return -1;
+        }
+    }
+
+    // Both directions: the client's own set, and the name's set of muters
+    int rc = id_set_add(&client->muted_names, entry->name_id);
+    if (rc != 0) {
+        release_muted_name_locked(entry);
+        return -1; // Client is already muted (or out of memory)
+    }
+    if (id_set_add(&entry->muters, client->client_id) < 0) {
+        id_set_remove(&client->muted_names, entry->name_id);
+        release_muted_name_locked(entry);
+        return -1;
+    }
+
+    mark_snapshot_mutes_dirty();
+    LOG_DEBUG("Client '%s' muted '%.*s'\n", client->client_name, (int)muted_name.length, muted_name.data);
+    return 0;  // Success
+}
+
+// Remove a name from a client's mutes (unmute, write lock must be held)
+int remove_muted_client(client_node_t *client, str_view_t muted_name) {
+    muted_name_t *entry = find_muted_name_locked(muted_name);
+    if (entry == NULL || id_set_remove(&client->muted_names, entry->name_id) != 0) {
+        return -1;  // Not found in muted list
+    }
+    id_set_remove(&entry->muters, client->client_id);
+    release_muted_name_locked(entry);
+    mark_snapshot_mutes_dirty();
+
+    LOG_DEBUG("Client '%s' unmuted '%.*s'\n", client->client_name, (int)muted_name.length, muted_name.data);
+    return 0;
+}
+
+// Function to clean up the client's mutes when the client disconnects (write lock must be held)
+void cleanup_muted_list(client_node_t *client) {
+    if (client->muted_names.count > 0) {
+        mark_snapshot_mutes_dirty();
+    }
+    for (int i = 0; i < client->muted_names.count; i++) {
+        muted_name_t *entry = client_list.muted_names.by_id[client->muted_names.ids[i]];
+        id_set_remove(&entry->muters, client->client_id);
+        release_muted_name_locked(entry);
+    }
+    id_set_free(&client->muted_names);
+}
+
+// Put a timer in the slot for its deadline (wheel lock must be held)
+// The level is the lowest one whose slots reach the deadline from the current tick
+void timer_wheel_place_locked(timer_wheel_t *wheel, client_timer_t *timer) {
+    time_t deadline = timer->deadline;
+    if (deadline <= wheel->current_tick) {
+        deadline = wheel->current_tick + 1; // Overdue: fire on the next tick
+    }
+
+    int level = TIMER_WHEEL_LEVELS - 1;
+    size_t slot = ((wheel->current_tick >> (level * TIMER_WHEEL_SLOT_BITS)) + TIMER_WHEEL_SLOTS - 1) & (TIMER_WHEEL_SLOTS - 1);
+    for (int l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+        int shift = l * TIMER_WHEEL_SLOT_BITS;
+        if ((deadline >> shift) - (wheel->current_tick >> shift) < TIMER_WHEEL_SLOTS) {
+            level = l;
+            slot = (deadline >> shift) & (TIMER_WHEEL_SLOTS - 1);
+            break;
+        }
+    }
+    // (Deadlines beyond the top level wait in its furthest slot and are placed again when it comes up)
+
+    timer->next = wheel->slots[level][slot];
+    wheel->slots[level][slot] = timer;
+}
+
+void timer_wheel_schedule(timer_wheel_t *wheel, client_timer_t *timer) {
+    shared_mutex_lock(&wheel->lock);
+    timer_wheel_place_locked(wheel, timer);
+    wheel->pending++;
+    shared_mutex_unlock(&wheel->lock);
+}
+
+// Advance the wheel tick by tick up to 'now' and take out every timer that expired
+// Returns the expired timers as a list (NULL if none); they are no longer in the wheel
+client_timer_t *timer_wheel_advance(timer_wheel_t *wheel, time_t now) {
+    client_timer_t *expired = NULL;
+    shared_mutex_lock(&wheel->lock);
+
+    while (wheel->current_tick < now) {
+        time_t tick = ++wheel->current_tick;
+
+        // A higher-level slot whose time has come moves its timers down (highest level first)
+        for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            int shift = level * TIMER_WHEEL_SLOT_BITS;
+            if ((tick & (((time_t)1 << shift) - 1)) != 0) {
+                continue;
+            }
+            size_t slot = (tick >> shift) & (TIMER_WHEEL_SLOTS - 1);
+            client_timer_t *timer = wheel->slots[level][slot];
+            wheel->slots[level][slot] = NULL;
+            while (timer != NULL) {
+                client_timer_t *next = timer->next;
+                if (timer->deadline <= tick) {
+                    timer->next = expired;
+                    expired = timer;
+                    wheel->pending--;
+                } else {
+                    timer_wheel_place_locked(wheel, timer);
+                }
+                timer = next;
+            }
+        }
+
+        size_t slot = tick & (TIMER_WHEEL_SLOTS - 1);
+        client_timer_t *timer = wheel->slots[0][slot];
+        wheel->slots[0][slot] = NULL;
+        while (timer != NULL) {
+            client_timer_t *next = timer->next;
+            timer->next = expired;
+            expired = timer;
+            wheel->pending--;
+            timer = next;
+        }
+    }
+
+    shared_mutex_unlock(&wheel->lock);
+    return expired;
+}
+
+// Free every pending timer (called on server shutdown)
+void destroy_timer_wheel() {
+    shared_mutex_lock(&client_timers.lock);
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            client_timer_t *timer = client_timers.slots[level][slot];
+            while (timer != NULL) {
+                client_timer_t *next = timer->next;
+                slab_free(&client_timer_slab, timer);
+                timer = next;
+            }
+            client_timers.slots[level][slot] = NULL;
+        }
+    }
+    client_timers.pending = 0;
+    shared_mutex_unlock(&client_timers.lock);
+    pthread_mutex_destroy(&client_timers.lock);
+    LOG_INFO("Timer wheel destroyed\n");
+}
+
+// Bytes a record takes in a block, header included
+size_t history_record_size(uint32_t length) {
+    return (sizeof(history_record_t) + length + 7) & ~(size_t)7;
+}
+
+// Retire head blocks that hold no kept record (history lock must be held)
+// The tail block is kept even when empty, so appends can carry on in it. Once a new tail is linked after
+// an emptied one (after a restart, or with a depth of 0), the emptied block is left as the head and goes here
+void retire_empty_head_locked(chat_history_t *history) {
+    while (history->head != history->tail &&
+           history->head_offset >= atomic_load_explicit(&history->head->used, memory_order_relaxed)) {
+        history_block_t *old_head = history->head;
+        history->head = old_head->next;
+        history->head_offset = 0;
+        history->block_count--;
+        epoch_retire(old_head, free); // A reader may still be walking it
+    }
+}
+
+// Drop the oldest record, retiring its block once nothing kept is left in it (history lock must be held)
+void drop_oldest_history_locked(chat_history_t *history) {
+    history_record_t *record = (history_record_t *)(history->head->data + history->head_offset);
+    history->payload_bytes -= record->length;
+    history->head_offset += history_record_size(record->length);
+    history->first_seq++;
+    retire_empty_head_locked(history);
+}
+
+// Drop every kept record and give the next one seq (history lock must be held)
+void restart_history_locked(chat_history_t *history, uint64_t seq) {
+    while (history->first_seq < history->next_seq) {
+        drop_oldest_history_locked(history);
+    }
+    history->first_seq = seq;
+    history->next_seq = seq;
+}
+
+// Append a record to the in-memory history, dropping the oldest ones beyond the configured depth
+// (history lock must be held). If seq does not follow the newest record, the older ones are dropped so
+// the kept records stay consecutive
+void append_history_locked(chat_history_t *history, uint64_t seq, const char *message, size_t length) {
+    if (length > BUFFER_SIZE) {
+        length = BUFFER_SIZE;
+    }
+    size_t record_size = history_record_size((uint32_t)length);
+
+    if (seq != history->next_seq) {
+        restart_history_locked(history, seq);
+    }
+
+    // Records are appended after what readers may be walking, never over it, so a full tail gets a new block
+    size_t tail_used = history->tail != NULL ? atomic_load_explicit(&history->tail->used, memory_order_relaxed) : 0;
+    if (history->tail == NULL || tail_used + record_size > HISTORY_BLOCK_SIZE) {
+        history_block_t *block = (history_block_t *)malloc(sizeof(history_block_t));
+        if (block == NULL) {
+            fprintf(stderr, "Failed to allocate history block\n");
+            return;
+        }
+        block->next = NULL;
+        atomic_init(&block->used, 0);
+        tail_used = 0;
+        if (history->tail == NULL) {
+            history->head = block;
+            history->head_offset = 0;
+        } else {
+            history->tail->next = block;
+        }
+        history->tail = block;
+        history->block_count++;
+        retire_empty_head_locked(history);
+    }
+
+    history_record_t *record = (history_record_t *)(history->tail->data + tail_used);
+    record->seq = history->next_seq++;
+    record->length = (uint32_t)length;
+    memcpy(record + 1, message, length);
+    atomic_store_explicit(&history->tail->used, tail_used + record_size, memory_order_relaxed);
+    history->payload_bytes += length;
+
+    while (history->next_seq - history->first_seq > history->depth) {
+        drop_oldest_history_locked(history);
+    }
+}
+
+// Append a message to the history and, if enabled, the on-disk log (history lock must be held)
+// message is the payload only ("name: message"); joins add the history$ prefix when sending
+// Returns the message's seq, which clients use to resume after a reconnect
+uint64_t add_to_history_locked(chat_history_t *history, const char *message, size_t length) {
+    uint64_t seq = history->next_seq;
+    if (history->log != NULL && history_log_append(history->log, seq, message, (uint32_t)length) != 0) {
+        // Keep chatting from memory rather than fail every say$
+        fprintf(stderr, "Failed to write the history log, history is no longer persisted\n");
+        history_log_close(history->log);
+        history->log = NULL;
+    }
+    append_history_locked(history, seq, message, length);
+    return seq;
+}
+
+uint64_t add_to_history(chat_history_t *history, const char *message, size_t length) {
+    shared_mutex_lock(&history->lock);
+    uint64_t seq = add_to_history_locked(history, message, length);
+    shared_mutex_unlock(&history->lock);
+    return seq;
+}
+
+void replay_history_record(uint64_t seq, const char *data, uint32_t length, void *arg) {
+    append_history_locked((chat_history_t *)arg, seq, data, length);
+}
+
+// Open the persistent history log and refill the in-memory history from its tail
+// Only the newest history_depth records are read, starting from the sparse index entry nearest to them
+// Returns 0 on success, -1 if the log cannot be opened
+int load_chat_history(const char *directory) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (history_log_open(&chat_history_log, directory, (size_t)server_config.history_segment_kb * 1024,
+                         server_config.history_retain_segments) != 0) {
+        return -1;
+    }
+
+    shared_mutex_lock(&chat_history.lock);
+    uint64_t next_seq = chat_history_log.next_seq;
+    uint64_t from_seq = next_seq > chat_history.depth ? next_seq - chat_history.depth : 1;
+    if (from_seq < history_log_first_seq(&chat_history_log)) {
+        from_seq = history_log_first_seq(&chat_history_log);
+    }
+    long replayed = history_log_replay(&chat_history_log, from_seq, replay_history_record, &chat_history);
+    if (chat_history.next_seq != next_seq) {
+        // Empty or damaged log: start numbering where the log carries on
+        restart_history_locked(&chat_history, next_seq);
+    }
+    chat_history.log = &chat_history_log;
+    shared_mutex_unlock(&chat_history.lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    LOG_INFO("Replayed %ld history messages from %s in %.2f ms (%d segments, next seq %llu)\n",
+           replayed, directory, elapsed_ms, chat_history_log.segment_count, (unsigned long long)next_seq);
+    return 0;
+}
+
+// Position a cursor on the oldest kept message after after_seq (0 = the oldest kept message)
+// Whole blocks before it are skipped by their first record's seq, so a resume only walks its own block
+// The caller must stay inside an epoch while it uses the cursor and the spans it returns
+void history_cursor_open(chat_history_t *history, history_cursor_t *cursor, uint64_t after_seq) {
+    shared_mutex_lock(&history->lock);
+    cursor->block = history->head;
+    cursor->offset = history->head_offset;
+    cursor->seq = history->first_seq;
+    cursor->end_seq = history->next_seq;
+
+    // A seq this history never handed out (the server restarted without a log) tells us nothing
+    if (after_seq >= cursor->end_seq) {
+        after_seq = 0;
+    }
+    if (after_seq >= cursor->seq) {
+        // Every block after the head starts with a kept record
+        while (cursor->block->next != NULL) {
+            history_record_t *first = (history_record_t *)cursor->block->next->data;
+            if (atomic_load_explicit(&cursor->block->next->used, memory_order_relaxed) == 0 || first->seq > after_seq + 1) {
+                break;
+            }
+            cursor->block = cursor->block->next;
+            cursor->offset = 0;
+            cursor->seq = first->seq;
+        }
+        while (cursor->seq <= after_seq) {
+            history_record_t *record = (history_record_t *)(cursor->block->data + cursor->offset);
+            cursor->offset += history_record_size(record->length);
+            cursor->seq++;
+        }
+    }
+    shared_mutex_unlock(&history->lock);
+}
+
+// Read the next message in place
+// Returns 1 and fills span, or 0 once every message kept when the cursor was opened has been read
+int history_cursor_next(history_cursor_t *cursor, history_span_t *span) {
+    if (cursor->seq >= cursor->end_seq) {
+        return 0;
+    }
+    // Every record before end_seq was written before the cursor was opened, so a stale 'used' is never too small
+    if (cursor->offset >= atomic_load_explicit(&cursor->block->used, memory_order_relaxed)) {
+        cursor->block = cursor->block->next;
+        cursor->offset = 0;
+    }
+    history_record_t *record = (history_record_t *)(cursor->block->data + cursor->offset);
+    span->seq = record->seq;
+    span->data = (const char *)(record + 1);
+    span->length = record->length;
+    cursor->offset += history_record_size(record->length);
+    cursor->seq++;
+    return 1;
+}
+
+// Destination addresses collected for one broadcast, one list per wire format
+// Each thread keeps its own and reuses them, so a broadcast does not allocate once it has grown to the room size
+typedef struct {
+    struct sockaddr_in *addresses;
+    int count;
+    int capacity;
+} broadcast_targets_t;
+
+__thread broadcast_targets_t broadcast_targets[WIRE_FORMAT_COUNT];
+
+// Append one destination, growing the array if needed
+// Returns 0 on success, -1 if out of memory
+int add_broadcast_target(broadcast_targets_t *targets, struct sockaddr_in *address) {
+    if (targets->count == targets->capacity) {
+        int new_capacity = targets->capacity == 0 ? 64 : targets->capacity * 2;
+        struct sockaddr_in *grown = (struct sockaddr_in *)realloc(targets->addresses, sizeof(struct sockaddr_in) * new_capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "Failed to grow broadcast target list\n");
+            return -1;
+        }
+        targets->addresses = grown;
+        targets->capacity = new_capacity;
+    }
+    targets->addresses[targets->count++] = *address;
+    return 0;
+}
+
+// Add the members in a snapshot's chunks to targets[WIRE_TEXT] or targets[WIRE_BINARY] by the framing each uses
+// skip_address: client that should not receive the message (e.g. the sender), or NULL
+// muters: client_ids of everyone who muted the sender (sorted; empty for system messages)
+void collect_chunk_targets(broadcast_targets_t *targets, snapshot_chunk_t **chunks, uint32_t chunk_count, uint32_t member_count,
+                           struct sockaddr_in *skip_address, id_set_t *muters) {
+    for (uint32_t c = 0; c < chunk_count; c++) {
+        snapshot_chunk_t *chunk = chunks[c];
+        uint32_t in_chunk = member_count - c * SNAPSHOT_CHUNK_MEMBERS;
+        if (in_chunk > SNAPSHOT_CHUNK_MEMBERS) {
+            in_chunk = SNAPSHOT_CHUNK_MEMBERS;
+        }
+
+        for (uint32_t i = 0; i < in_chunk; i++) {
+            snapshot_member_t *current = &chunk->members[i];
+
+            // Skip the sender (they don't need to see their own message)
+            if (skip_address != NULL && same_address(&current->client_address, skip_address)) {
+                continue;
+            }
+
+            // Skip recipients who have muted the sender
+            if (muters->count > 0 && id_set_contains(muters, current->client_id)) {
+                LOG_DEBUG("Skipping message to client %u (they muted the sender)\n", current->client_id);
+                continue;
+            }
+
+            add_broadcast_target(&targets[current->wire_format], &current->client_address);
+        }
+    }
+}
+
+// Everyone who muted muted_sender, from the client snapshot (empty if muted_sender is NULL)
+// One lookup gives them all, so recipients' own mute sets are never touched
+id_set_t snapshot_muters(client_snapshot_t *snapshot, const char *muted_sender) {
+    id_set_t muters = {NULL, 0, 0};
+    if (muted_sender != NULL) {
+        const snapshot_muted_name_t *entry = snapshot_find_muted_name(snapshot->mutes, muted_sender);
+        if (entry != NULL) {
+            muters.ids = (uint32_t *)entry->muters;
+            muters.count = entry->muter_count;
+        }
+    }
+    return muters;
+}
+
+void clear_broadcast_targets(broadcast_targets_t *targets) {
+    for (int format = 0; format < WIRE_FORMAT_COUNT; format++) {
+        targets[format].count = 0;
+    }
+}
+
+// Collect the address of every client a broadcast should reach from the published snapshot
+// (caller must be inside an epoch; no client list lock is needed)
+// muted_sender: name of the sender, so recipients who muted them are skipped, or NULL for system messages
+void collect_broadcast_targets(broadcast_targets_t *targets, struct sockaddr_in *skip_address, const char *muted_sender) {
+    clear_broadcast_targets(targets);
+    client_snapshot_t *snapshot = atomic_load_explicit(&client_list.snapshot, memory_order_acquire);
+    id_set_t muters = snapshot_muters(snapshot, muted_sender);
+    collect_chunk_targets(targets, snapshot->chunks, snapshot->chunk_count, snapshot->member_count, skip_address, &muters);
+}
+
+// Same for the members in a room's snapshot (caller must be inside an epoch)
+// A room created in a write section that has not been released yet has no snapshot (NULL), and nobody to reach
+void collect_room_targets(broadcast_targets_t *targets, room_snapshot_t *members, struct sockaddr_in *skip_address, const char *muted_sender) {
+    clear_broadcast_targets(targets);
+    if (members == NULL) {
+        return;
+    }
+    id_set_t muters = snapshot_muters(atomic_load_explicit(&client_list.snapshot, memory_order_acquire), muted_sender);
+    collect_chunk_targets(targets, members->chunks, members->chunk_count, members->member_count, skip_address, &muters);
+}
+
+// Send one text message to every collected target, converting it into a frame once for the binary ones
+int send_to_targets(int socket_descriptor, broadcast_targets_t *targets, const char *message, int n) {
+    int sent = 0;
+    if (targets[WIRE_TEXT].count > 0) {
+        sent += send_to_clients(socket_descriptor, targets[WIRE_TEXT].addresses, targets[WIRE_TEXT].count, message, n);
+    }
+    if (targets[WIRE_BINARY].count > 0) {
+        char frame[BUFFER_SIZE];
+        int frame_length = wire_encode_text(frame, sizeof(frame), message, n, 1);
+        if (frame_length < 0) {
+            fprintf(stderr, "Failed to frame message '%.*s'\n", n, message);
+            return sent;
+        }
+        sent += send_to_clients(socket_descriptor, targets[WIRE_BINARY].addresses, targets[WIRE_BINARY].count, frame, frame_length);
+    }
+    return sent;
+}
+
+// Send a message to every connected client (see collect_chunk_targets and collect_broadcast_targets for the arguments)
+// The destination list comes from the client snapshot, so a broadcast never waits for conn$, disconn$
+// or rename$ and never holds them up; the sends use sendmmsg so the whole fan-out takes a handful of syscalls
+int broadcast_message(const char *message, struct sockaddr_in *skip_address, const char *muted_sender, int socket_descriptor) {
+    broadcast_targets_t *targets = broadcast_targets;
+
+    epoch_enter();
+    collect_broadcast_targets(targets, skip_address, muted_sender);
+    epoch_exit();
+    stats_record_broadcast(targets[WIRE_TEXT].count + targets[WIRE_BINARY].count);
+
+    return send_to_targets(socket_descriptor, targets, message, strlen(message));
+}
+
+// Send a message to the members of one room (see broadcast_message)
+// members is a snapshot of the room the caller loaded itself, or NULL to take the room's current one
+// (a caller passing a snapshot must be inside an epoch)
+int broadcast_to_room(room_t *room, room_snapshot_t *members, const char *message, struct sockaddr_in *skip_address,
+                      const char *muted_sender, int socket_descriptor) {
+    broadcast_targets_t *targets = broadcast_targets;
+
+    epoch_enter();
+    if (members == NULL) {
+        members = atomic_load_explicit(&room->snapshot, memory_order_acquire);
+    }
+    collect_room_targets(targets, members, skip_address, muted_sender);
+    epoch_exit();
+    stats_record_broadcast(targets[WIRE_TEXT].count + targets[WIRE_BINARY].count);
+
+    return send_to_targets(socket_descriptor, targets, message, strlen(message));
+}
+
+// Parse request into command type and content (format: "command$content"), both trimmed
+// They are views into the request, which has to outlive them; nothing is copied
+int parse_request(str_view_t request, str_view_t *command_type, str_view_t *content) {
+    if (view_split(request, '$', command_type, content) != 0) {
+        LOG_DEBUG("Invalid request format: no '$' delimiter found\n");
+        return -1;
+    }
+    if (command_type->length == 0) {
+        LOG_DEBUG("Invalid request format: command type invalid\n");
+        return -1;
+    }
+    *command_type = view_trim(*command_type);
+    *content = view_trim(*content);
+    return 0;
+}
+
+// Send one histpack$ datagram: "histpack$<count> <seq of the first record>\n" followed by count records
+// of "<length> <payload>" with consecutive seqs
+void send_history_pack(int socket_descriptor, struct sockaddr_in *client_address, int count, uint64_t first_seq,
+                       const char *records, int records_length) {
+    char datagram[HISTORY_PACK_MAX_BYTES + 1];
+    int n = snprintf(datagram, sizeof(datagram), "histpack$%d %llu\n", count, (unsigned long long)first_seq);
+    memcpy(datagram + n, records, records_length);
+    send_to_client(socket_descriptor, client_address, datagram, n + records_length);
+}
+
+// Pack the messages left in cursor into histpack$ datagrams, for text clients
+// Returns the number of messages sent and adds the datagrams used to *datagram_count
+int send_history_packs(int socket_descriptor, struct sockaddr_in *client_address, history_cursor_t *cursor, int *datagram_count) {
+    char records[HISTORY_PACK_MAX_BYTES];
+    int records_length = 0;
+    int pack_count = 0;
+    uint64_t pack_first_seq = 0;
+    int message_count = 0;
+    history_span_t span;
+
+    while (history_cursor_next(cursor, &span)) {
+        char prefix[16];
+        int prefix_length = snprintf(prefix, sizeof(prefix), "%u ", span.length);
+        int record_length = prefix_length + (int)span.length;
+
+        // Packs hold consecutive messages, so one that cannot join the pack closes it
+        if (pack_count > 0 && (HISTORY_PACK_HEADER_MAX + records_length + record_length > HISTORY_PACK_MAX_BYTES ||
+                               HISTORY_PACK_HEADER_MAX + record_length > HISTORY_PACK_MAX_BYTES)) {
+            send_history_pack(socket_descriptor, client_address, pack_count, pack_first_seq, records, records_length);
+            (*datagram_count)++;
+            records_length = 0;
+            pack_count = 0;
+        }
+
+        if (HISTORY_PACK_HEADER_MAX + record_length > HISTORY_PACK_MAX_BYTES) {
+            // Too long to pack even on its own: send it the old way
+            char history_message[BUFFER_SIZE];
+            int n = snprintf(history_message, BUFFER_SIZE, "history$ [%llu] %.*s\n",
+                             (unsigned long long)span.seq, (int)span.length, span.data);
+            if (n >= BUFFER_SIZE) {
+                n = BUFFER_SIZE - 1;
+            }
+            send_to_client(socket_descriptor, client_address, history_message, n);
+            message_count++;
+            (*datagram_count)++;
+            continue;
+        }
+        if (pack_count == 0) {
+            pack_first_seq = span.seq;
+        }
+        memcpy(records + records_length, prefix, prefix_length);
+        memcpy(records + records_length + prefix_length, span.data, span.length);
+        records_length += record_length;
+        pack_count++;
+        message_count++;
+    }
+
+    if (pack_count > 0) {
+        send_history_pack(socket_descriptor, client_address, pack_count, pack_first_seq, records, records_length);
+        (*datagram_count)++;
+    }
+    return message_count;
+}
+
+// Pack the messages left in cursor into HISTPACK frames, one per datagram, for binary clients
+// The frame header carries the first message's seq, and each message after it just a 2-byte length
+// Returns the number of messages sent and adds the datagrams used to *datagram_count
+int send_history_frames(int socket_descriptor, struct sockaddr_in *client_address, history_cursor_t *cursor, int *datagram_count) {
+    char datagram[HISTORY_PACK_MAX_BYTES];
+    int datagram_length = WIRE_HEADER_SIZE; // Header is written when the frame is sent
+    uint64_t frame_first_seq = 0;
+    int message_count = 0;
+    history_span_t span;
+
+    while (history_cursor_next(cursor, &span)) {
+        int length = (int)span.length;
+        if (WIRE_HEADER_SIZE + 2 + length > HISTORY_PACK_MAX_BYTES) {
+            length = HISTORY_PACK_MAX_BYTES - WIRE_HEADER_SIZE - 2; // Cut like an oversized history$ message
+        }
+        if (datagram_length + 2 + length > HISTORY_PACK_MAX_BYTES) {
+            wire_encode_header(datagram, WIRE_OP_HISTPACK, (uint32_t)frame_first_seq, datagram_length - WIRE_HEADER_SIZE);
+            send_to_client(socket_descriptor, client_address, datagram, datagram_length);
+            (*datagram_count)++;
+            datagram_length = WIRE_HEADER_SIZE;
+        }
+        if (datagram_length == WIRE_HEADER_SIZE) {
+            frame_first_seq = span.seq;
+        }
+        datagram[datagram_length] = (char)(length >> 8);
+        datagram[datagram_length + 1] = (char)length;
+        memcpy(datagram + datagram_length + 2, span.data, length);
+        datagram_length += 2 + length;
+        message_count++;
+    }
+
+    if (datagram_length > WIRE_HEADER_SIZE) {
+        wire_encode_header(datagram, WIRE_OP_HISTPACK, (uint32_t)frame_first_seq, datagram_length - WIRE_HEADER_SIZE);
+        send_to_client(socket_descriptor, client_address, datagram, datagram_length);
+        (*datagram_count)++;
+    }
+    return message_count;
+}
+
+// Send the chat history after after_seq and before end_seq to a client that just joined (after_seq = 0
+// for all of it), packing as many messages as fit into each datagram. If messages after after_seq have
+// already been dropped from the history, a gap$ message says how many are missing
+// end_seq is chat_history.next_seq from when the client became visible to say$: later messages reach it live
+// Messages are read in place from the history arena and copied once, into the datagram
+void send_history(int socket_descriptor, struct sockaddr_in *client_address, uint64_t after_seq, uint64_t end_seq) {
+    int message_count = 0;
+    int datagram_count = 0;
+
+    epoch_enter();
+    history_cursor_t cursor;
+    history_cursor_open(&chat_history, &cursor, after_seq);
+    if (cursor.end_seq > end_seq) {
+        cursor.end_seq = end_seq;
+    }
+    if (after_seq > 0 && after_seq < cursor.end_seq && cursor.seq > after_seq + 1) {
+        char gap_msg[BUFFER_SIZE];
+        snprintf(gap_msg, BUFFER_SIZE, "gap$ %llu messages were missed and are no longer in the history\n",
+                 (unsigned long long)(cursor.seq - after_seq - 1));
+        send_reply(socket_descriptor, client_address, gap_msg, strlen(gap_msg));
+    }
+    if (request_format == WIRE_BINARY) {
+        message_count = send_history_frames(socket_descriptor, client_address, &cursor, &datagram_count);
+    } else {
+        message_count = send_history_packs(socket_descriptor, client_address, &cursor, &datagram_count);
+    }
+    epoch_exit();
+
+    if (message_count > 0) {
+        LOG_DEBUG("Sent %d history messages in %d datagrams\n", message_count, datagram_count);
+    }
+}
+
+// Add a client and send it the history after resume_after_seq (0 = all of it)
+// Shared by conn$ and reconn$; content is the requested name. Returns 0 if the client was added, -1 if not
+int connect_client(str_view_t content, struct sockaddr_in *client_address, int socket_descriptor, uint64_t resume_after_seq){
+    if (content.length == 0 || content.length >= MAX_NAME_LEN){
+        char error_msg[BUFFER_SIZE];
+        snprintf(error_msg, BUFFER_SIZE, "Error$ No name or too long of a name. Expected 'conn$ [NAME]'\n");
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+
     // Trim the content to get the name
-    char trimmed_content[MAX_NAME_LEN];
-    strncpy(trimmed_content, content, MAX_NAME_LEN - 1);
-    trimmed_content[MAX_NAME_LEN - 1] = '\0';
-    char *trimmed_name = trim(trimmed_content);
+    str_view_t trimmed_name = view_trim(content);
     
+    //Check if this address is already connected (one client per address)
+    if (find_client_by_address(client_address) != NULL){
+        char error_msg[BUFFER_SIZE];
+        snprintf(error_msg, BUFFER_SIZE, "Error$ You are already connected. Use 'rename$ [NEW_NAME]' to change your name\n");
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+
     //Check if name already exists
     if (find_client_by_name(trimmed_name) != NULL){
         char error_msg[BUFFER_SIZE];
         snprintf(error_msg, BUFFER_SIZE, "Error$ Name already taken. Please choose another name\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
     }
 
     //Determine if the client is admin
     int client_port = ntohs(client_address->sin_port); //undos htons as seen in udp.h. Converts back (network-short-to-host)
-    printf("[DEBUG] Client_port: %d\n", client_port);
+    LOG_DEBUG("Client_port: %d\n", client_port);
     int is_admin = 0;
 
     if (client_port == 6666){
         is_admin = 1;
     }
 
-    client_node_t *added_client_node = add_client(trimmed_name, client_address, is_admin);
+    // The one copy of the name: the client list keeps it as a C string
+    char client_name[MAX_NAME_LEN];
+    memcpy(client_name, trimmed_name.data, trimmed_name.length);
+    client_name[trimmed_name.length] = '\0';
+
+    // The history end is read and the client published under the history lock say$ numbers messages under,
+    // so every lobby message is either before history_end or broadcast to a snapshot that has the client
+    shared_mutex_lock(&chat_history.lock);
+    uint64_t history_end = chat_history.next_seq;
+    client_node_t *added_client_node = add_client(client_name, client_address, is_admin, request_format);
+    shared_mutex_unlock(&chat_history.lock);
 
     if(added_client_node == NULL){
         char error_msg[BUFFER_SIZE];
         snprintf(error_msg, BUFFER_SIZE, "Error$ Error adding client to client list\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
     }
 
     update_client_active_time(client_address);
 
     //send connection response
     char response[BUFFER_SIZE];
-    snprintf(response, BUFFER_SIZE, "conn$ Hi %s, you have successfully connected to the chat\n", trimmed_name);
-    udp_socket_write(socket_descriptor, client_address, response, strlen(response));
+    snprintf(response, BUFFER_SIZE, "conn$ Hi %s, you have successfully connected to the chat\n", client_name);
+    send_reply(socket_descriptor, client_address, response, strlen(response));
 
-    //send history messages
-    char history_messages[15][BUFFER_SIZE];
-    int history_message_count = get_history(history_messages);
+    //send history messages (only the ones missed when resuming), several per datagram
+    send_history(socket_descriptor, client_address, resume_after_seq, history_end);
 
-    for (int i = 0; i < history_message_count; i++){
-        udp_socket_write(socket_descriptor, client_address, history_messages[i], strlen(history_messages[i]));
+    return 0;
+}
 
-    }
+int handle_conn(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor){
+    (void)sender;
+    return connect_client(content, client_address, socket_descriptor, 0);
+}
 
-    return;
+// reconn$ <last seq> <name>: connect, but only send the history after the last message the client has
+// (as a frame, the last seq is in the header and the content is just the name)
+int handle_reconn(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor){
+    (void)sender;
+    str_view_t name = content;
+    unsigned long long last_seq = 0;
+    if (request_format == WIRE_BINARY){
+        // The header has the low 32 bits: take the full seq closest to the newest message
+        shared_mutex_lock(&chat_history.lock);
+        uint64_t newest_seq = chat_history.next_seq - 1;
+        shared_mutex_unlock(&chat_history.lock);
+        last_seq = wire_widen_seq(request_seq, newest_seq);
+    } else {
+        str_view_t seq_text;
+        int valid = view_split(content, ' ', &seq_text, &name) == 0 && seq_text.length > 0;
+        for (size_t i = 0; valid && i < seq_text.length; i++){
+            valid = seq_text.data[i] >= '0' && seq_text.data[i] <= '9';
+            last_seq = last_seq * 10 + (seq_text.data[i] - '0');
+        }
+        if (!valid){
+            char error_msg[BUFFER_SIZE];
+            snprintf(error_msg, BUFFER_SIZE, "Error$ Invalid reconnect. Expected 'reconn$ [LAST_SEQ] [NAME]'\n");
+            send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+            return -1;
+        }
+        name = view_trim(name);
+    }
+    LOG_DEBUG("Client resuming after history seq %llu\n", last_seq);
+    return connect_client(name, client_address, socket_descriptor, last_seq);
 }
 
-void handle_say(const char *content, struct sockaddr_in *client_address, int socket_descriptor){
-    size_t len = strlen(content);
-    
+int handle_say(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor){
     //invalid message
-    if (len == 0 || len >= MAX_NAME_LEN){
+    if (content.length == 0 || content.length >= MAX_NAME_LEN){
         char error_msg[BUFFER_SIZE];
         snprintf(error_msg, BUFFER_SIZE, "Error$ No message content or too long of a message. Expected 'say$ [MESSAGE]'\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
     }
     
-    client_node_t *sender_address = find_client_by_address(client_address);
-    //We can't find the client in the client list. Therefore, send error to client and ask to connect first
-    if (sender_address == NULL){
-        char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, "Error$ You have not connected to server yet. Please connect to server using 'conn$ [NAME].\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));  
-        return;
-    }
+    // The lobby's messages are numbered in chat_history; other rooms keep their own history, without seqs
+    // (the room stays valid until this request's epoch_exit, even if the sender leaves it meanwhile)
+    room_t *room = atomic_load_explicit(&sender->room, memory_order_acquire);
 
-    //message preparation
+    //add to history first, so the broadcast can carry the message's seq
+    //(history keeps just "name: message"; the history$ prefix is added when it is sent)
+    char history_message[BUFFER_SIZE];
+    int history_length = snprintf(history_message, BUFFER_SIZE, "%s: %.*s", sender->client_name, (int)content.length, content.data);
+    if (history_length >= BUFFER_SIZE) {
+        history_length = BUFFER_SIZE - 1;
+    }
     char message[BUFFER_SIZE];
-    snprintf(message, BUFFER_SIZE, "say$ %s: %s\n", sender_address->client_name, content);
-    
-    //send message
-    //broadcast_message(message, client_address, socket_descriptor);
-
-    pthread_rwlock_rdlock(&client_list.lock);
-
-    // Broadcast to all clients, but skip if they muted the sender
-    client_node_t *current = client_list.head;
-    while (current != NULL) {
-        // Skip sending to sender (they don't need to see their own message)
-        // Compare addresses to see if this is the sender
-        if (current->client_address.sin_addr.s_addr == client_address->sin_addr.s_addr &&
-            current->client_address.sin_port == client_address->sin_port) {
-            // This is the sender - skip them
-            current = current->next;
-            continue;
-        }
-        
-        // Check if this recipient has muted the sender
-        // sender_address->client_name is the name of who sent the message
-        if (is_client_muted_locked(current, sender_address->client_name)) {
-            // This recipient has muted the sender - skip sending to them
-            printf("[DEBUG] Skipping message to '%s' (they muted '%s')\n", 
-                   current->client_name, sender_address->client_name);
-            current = current->next;
-            continue;
-        }
-        
-        // Send message to this client (they haven't muted the sender)
-        udp_socket_write(socket_descriptor, &current->client_address, (char *) message, strlen(message));
-        current = current->next;
+    room_snapshot_t *members = NULL;
+    if (room == client_list.lobby) {
+        // The seq and the members it goes to are taken under one history lock, and connect_client publishes
+        // a new client under that lock too: a message either goes out before the client is visible, with a
+        // seq inside its history replay, or reaches it live with a seq past the replay, never both
+        shared_mutex_lock(&chat_history.lock);
+        uint64_t seq = add_to_history_locked(&chat_history, history_message, history_length);
+        members = atomic_load_explicit(&room->snapshot, memory_order_acquire);
+        shared_mutex_unlock(&chat_history.lock);
+
+        //message preparation: "[seq] " lets clients note the last message they got, to resume after it
+        snprintf(message, BUFFER_SIZE, "say$ [%llu] %s: %.*s\n", (unsigned long long)seq, sender->client_name, (int)content.length, content.data);
+    } else {
+        add_to_history(room->history, history_message, history_length);
+        snprintf(message, BUFFER_SIZE, "say$ #%s %s: %.*s\n", room->name, sender->client_name, (int)content.length, content.data);
     }
-    pthread_rwlock_unlock(&client_list.lock);
-
-    //add to history
-    char history_message[BUFFER_SIZE];
-    snprintf(history_message, BUFFER_SIZE, "history$ %s: %s\n", sender_address->client_name, content);
-    add_to_history(history_message);
+    
+    //send message to everyone in the room except the sender and anyone who muted them
+    broadcast_to_room(room, members, message, client_address, sender->client_name, socket_descriptor);
 
-    //housekeeping
-    update_client_active_time(client_address);
-    return;
+    return 0;
 }
 
 //parses message content to find recipient and message content (space seperated)
+//both come back trimmed, as views into content
 //returns 0 on sucess, 1 on fail
 //very similar (practically the same) to parsing for command type with $
-int parse_sayto(const char *content, char* recipient_name, char *message_content){
-    const char *space = strchr(content, ' ');
-    if (space == NULL){
-        printf("[DEBUG] Invalid sayto message format: no space delimiter found\n");
+int parse_sayto(str_view_t content, str_view_t *recipient_name, str_view_t *message_content){
+    if (view_split(content, ' ', recipient_name, message_content) != 0){
+        LOG_DEBUG("Invalid sayto message format: no space delimiter found\n");
         return 1;
     }
     
-    size_t name_len = space - content;
-    if (name_len == 0 || name_len >= MAX_NAME_LEN) {
-        printf("[DEBUG] Invalid request format: recipient name invalid\n");
+    if (recipient_name->length == 0 || recipient_name->length >= MAX_NAME_LEN) {
+        LOG_DEBUG("Invalid request format: recipient name invalid\n");
         return 1;
     }
 
-    strncpy(recipient_name, content, name_len);
-    recipient_name[name_len] = '\0';
-    size_t content_len = strlen(space + 1);
-    if (content_len >= BUFFER_SIZE) {
-        printf("[DEBUG] Invalid request format: message content too long\n");
-        return 1;
-    }
-    
-    strncpy(message_content, space + 1, BUFFER_SIZE - 1);
-    message_content[BUFFER_SIZE - 1] = '\0';
-    
     // Trim both recipient name and message content
-    char *trimmed_name = trim(recipient_name);
-    char *trimmed_msg = trim(message_content);
-    
-    strncpy(recipient_name, trimmed_name, MAX_NAME_LEN - 1);
-    recipient_name[MAX_NAME_LEN - 1] = '\0';
-    strncpy(message_content, trimmed_msg, BUFFER_SIZE - 1);
-    message_content[BUFFER_SIZE - 1] = '\0';
+    *recipient_name = view_trim(*recipient_name);
+    *message_content = view_trim(*message_content);
     
     return 0;
 }
 
-void handle_sayto(const char *content, struct sockaddr_in *client_address, int socket_descriptor){
-    size_t len = strlen(content);
-    
+int handle_sayto(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor){
     //invalid message
-    if (len == 0 || len >= BUFFER_SIZE){
+    if (content.length == 0 || content.length >= BUFFER_SIZE){
         char error_msg[BUFFER_SIZE];
         snprintf(error_msg, BUFFER_SIZE, "Error$ No message content or too long of a message. Expected 'sayto$ [RECIPEINT NAME] [MESSAGE]'\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
     }
     
-    client_node_t *sender_address = find_client_by_address(client_address);
-    //We can't find the client in the client list. Therefore, send error to client and ask to connect first
-    if (sender_address == NULL){
-        char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, "Error$ You have not connected to server yet. Please connect to server using 'conn$ [NAME].\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
-    }
-
     //parsing to find recipeient name and message content here
-    char recipient_name[MAX_NAME_LEN];
-    char message_content[BUFFER_SIZE];
+    str_view_t recipient_name;
+    str_view_t message_content;
 
-    int parse_rc = parse_sayto(content, recipient_name, message_content);
+    int parse_rc = parse_sayto(content, &recipient_name, &message_content);
     if (parse_rc != 0) {
         char error_msg[BUFFER_SIZE];
         snprintf(error_msg, BUFFER_SIZE, "Error$ Expected 'sayto$ [RECIPIENTNAME] [MESSAGE]'\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
     }
 
     client_node_t *recipient_address = find_client_by_name(recipient_name);
@@ -818,32 +2857,171 @@ void handle_sayto(const char *content, struct sockaddr_in *client_address, int s
     if (recipient_address == NULL){
         char error_msg[BUFFER_SIZE];
         snprintf(error_msg, BUFFER_SIZE, "Error$ Recipient not found, Please double check recipient name. Format: 'sayto$ [NAME] [MSG]'.\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
     }
     
     //message preparation
     char message[BUFFER_SIZE];
-    snprintf(message, BUFFER_SIZE, "sayto$ %s: %s\n", sender_address->client_name, message_content);
+    snprintf(message, BUFFER_SIZE, "sayto$ %s: %.*s\n", sender->client_name, (int)message_content.length, message_content.data);
     
-    udp_socket_write(socket_descriptor, &recipient_address->client_address, (char *) message, strlen(message));
+    send_message(socket_descriptor, &recipient_address->client_address, recipient_address->wire_format, message, strlen(message));
     //WARNING: THE BELOW LINES ALSO SENDS MESSAGE TO SENDER
-    udp_socket_write(socket_descriptor, client_address, (char *) message, strlen(message));
+    send_reply(socket_descriptor, client_address, (char *) message, strlen(message));
 
-    //housekeeping
-    update_client_active_time(client_address);
-    return;
+    return 0;
 }
 
-void handle_disconn(const char *content, struct sockaddr_in *client_address, int socket_descriptor){
-    size_t len = strlen(content);
-    
+// Room names: an optional leading '#', then up to MAX_ROOM_NAME_LEN - 1 letters, digits, '-' or '_'
+// Returns 0 and the name without the '#', or -1 if the name is invalid
+int parse_room_name(str_view_t content, str_view_t *room_name) {
+    if (content.length > 0 && content.data[0] == '#') {
+        content.data++;
+        content.length--;
+    }
+    if (content.length == 0 || content.length >= MAX_ROOM_NAME_LEN) {
+        return -1;
+    }
+    for (size_t i = 0; i < content.length; i++) {
+        char c = content.data[i];
+        if (!isalnum((unsigned char)c) && c != '-' && c != '_') {
+            return -1;
+        }
+    }
+    *room_name = content;
+    return 0;
+}
+
+// Move the client at client_address into the named room, creating the room on first use (join$ and leave$)
+// Returns 0 with the room left, the room entered and its member count, or -1 after replying with an error
+// Both rooms stay valid until this request's epoch_exit, even if the one left is deleted for being empty
+int move_to_room(str_view_t room_name, struct sockaddr_in *client_address, int socket_descriptor,
+                 room_t **left, room_t **entered, uint32_t *member_count) {
+    client_list_write_lock();
+
+    // Look the requester up again under the lock: they may have left since the request was dispatched
+    client_node_t *requester = find_client_by_address_locked(client_address);
+    if (requester == NULL) {
+        client_list_unlock();
+        char error_msg[BUFFER_SIZE];
+        snprintf(error_msg, BUFFER_SIZE, "Error$ You are not connected. Please connect first using 'conn$ [NAME]'\n");
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+
+    *left = atomic_load_explicit(&requester->room, memory_order_relaxed);
+    room_t *room = find_room_locked(room_name);
+    if (room == *left) {
+        client_list_unlock();
+        char error_msg[BUFFER_SIZE];
+        snprintf(error_msg, BUFFER_SIZE, "Error$ You are already in #%.*s\n", (int)room_name.length, room_name.data);
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+    if (room == NULL) {
+        room = create_room_locked(room_name);
+    }
+    // A room created just now that nobody could enter is still empty, so the unlock deletes it again
+    if (room == NULL || move_client_to_room_locked(requester, room) != 0) {
+        client_list_unlock();
+        char error_msg[BUFFER_SIZE];
+        snprintf(error_msg, BUFFER_SIZE, "Error$ Server is out of memory, could not change rooms\n");
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+    *entered = room;
+    *member_count = room->member_count;
+
+    client_list_unlock();
+    return 0;
+}
+
+// Send a room's history to a client that just joined it, one "history$ #room name: message" per datagram
+// (only the lobby's history is numbered, packed and resumable; see send_history)
+void send_room_history(room_t *room, int socket_descriptor, struct sockaddr_in *client_address) {
+    epoch_enter();
+    history_cursor_t cursor;
+    history_cursor_open(room->history, &cursor, 0);
+    history_span_t span;
+    while (history_cursor_next(&cursor, &span)) {
+        char history_message[BUFFER_SIZE];
+        int n = snprintf(history_message, BUFFER_SIZE, "history$ #%s %.*s\n", room->name, (int)span.length, span.data);
+        if (n >= BUFFER_SIZE) {
+            n = BUFFER_SIZE - 1;
+        }
+        send_reply(socket_descriptor, client_address, history_message, n);
+    }
+    epoch_exit();
+}
+
+// join$ <room>: leave the current room for another one (created if nobody is in it yet), then get its history
+int handle_join(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor) {
+    str_view_t room_name;
+    if (parse_room_name(content, &room_name) != 0) {
+        char error_msg[BUFFER_SIZE];
+        snprintf(error_msg, BUFFER_SIZE, "Error$ Invalid room name. Expected 'join$ [ROOM]' with up to %d letters, digits, '-' or '_'\n",
+                 MAX_ROOM_NAME_LEN - 1);
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+
+    room_t *left;
+    room_t *room;
+    uint32_t member_count;
+    // Like connect_client: someone moving into the lobby gets its history up to history_end, the rest live
+    shared_mutex_lock(&chat_history.lock);
+    uint64_t history_end = chat_history.next_seq;
+    int moved = move_to_room(room_name, client_address, socket_descriptor, &left, &room, &member_count);
+    shared_mutex_unlock(&chat_history.lock);
+    if (moved != 0) {
+        return -1;
+    }
+
+    char response[BUFFER_SIZE];
+    snprintf(response, BUFFER_SIZE, "join$ You joined #%s (%u member%s)\n", room->name, member_count, member_count == 1 ? "" : "s");
+    send_reply(socket_descriptor, client_address, response, strlen(response));
+
+    if (room == client_list.lobby) {
+        send_history(socket_descriptor, client_address, 0, history_end);
+    } else {
+        send_room_history(room, socket_descriptor, client_address);
+    }
+    LOG_DEBUG("Client '%s' moved from #%s to #%s\n", sender->client_name, left->name, room->name);
+    return 0;
+}
+
+// leave$: go back to the lobby (no history is resent: the client had it before joining)
+int handle_leave(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor) {
+    (void)sender;
+    //invalid command (there should be no content)
+    if (content.length != 0) {
+        char error_msg[BUFFER_SIZE];
+        snprintf(error_msg, BUFFER_SIZE, "Error$ Invalid leave$ command. Expected 'leave$'\n");
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+
+    room_t *left;
+    room_t *lobby;
+    uint32_t member_count;
+    if (move_to_room(view_of(LOBBY_ROOM_NAME), client_address, socket_descriptor, &left, &lobby, &member_count) != 0) {
+        return -1;
+    }
+
+    char response[BUFFER_SIZE];
+    snprintf(response, BUFFER_SIZE, "leave$ You left #%s and are back in #%s\n", left->name, lobby->name);
+    send_reply(socket_descriptor, client_address, response, strlen(response));
+    return 0;
+}
+
+int handle_disconn(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor){
+    (void)sender;
     //invalid command (there should be no content)
-    if (len != 0){
+    if (content.length != 0){
         char error_msg[BUFFER_SIZE];
         snprintf(error_msg, BUFFER_SIZE, "Error$ Invalid disconn$ command. Expected 'disconn$'\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
     }
     
     client_node_t *sender_address = find_client_by_address(client_address);
@@ -853,8 +3031,8 @@ void handle_disconn(const char *content, struct sockaddr_in *client_address, int
         if (remove_client_by_address(client_address) != 0){
         char error_msg[BUFFER_SIZE];
         snprintf(error_msg, BUFFER_SIZE, "Error$ Erorr encountered during removal of client from server. Please try again.\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
         }
     }
     
@@ -862,376 +3040,528 @@ void handle_disconn(const char *content, struct sockaddr_in *client_address, int
     char message[BUFFER_SIZE];
     snprintf(message, BUFFER_SIZE, "disconn$ Disconnected. Bye!\n");
     
-    udp_socket_write(socket_descriptor, client_address, (char *) message, strlen(message));
+    send_reply(socket_descriptor, client_address, (char *) message, strlen(message));
     
     //no need to update client_active_time as we no longer have that in client list anymore.
-    return;
+    return 0;
 }
 
 // Handle mute$ command - add a client to the requester's muted list
-void handle_mute(const char *content, struct sockaddr_in *client_address, int socket_descriptor) {
+int handle_mute(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor) {
+    (void)client_address;
+    (void)socket_descriptor;
    // Validate content length
-   size_t len = strlen(content);
-   if (len == 0 || len >= MAX_NAME_LEN) {
+   if (content.length == 0 || content.length >= MAX_NAME_LEN) {
        // Invalid - but per requirements, mute$ doesn't send error responses
        // So we just return silently
-       return;
+       return -1;
    }
    
    // Trim the content to get the name to mute
-   char muted_name[MAX_NAME_LEN];
-   strncpy(muted_name, content, MAX_NAME_LEN - 1);
-   muted_name[MAX_NAME_LEN - 1] = '\0';
-   char *trimmed_name = trim(muted_name);
+   str_view_t trimmed_name = view_trim(content);
    
-   // Find the requester (who wants to mute someone)
-   client_node_t *requester = find_client_by_address(client_address);
-   if (requester == NULL) {
-       // Client not connected - but mute$ doesn't send errors, so return
-       return;
-   }
-   
-   // Check if requester is trying to mute themselves (optional validation)
-   if (strcmp(requester->client_name, trimmed_name) == 0) {
+   // Check if sender is trying to mute themselves (optional validation)
+   if (view_equals(trimmed_name, sender->client_name)) {
        // Can't mute yourself - silently return
-       return;
+       return -1;
    }
    
    // Find the client to mute
    client_node_t *to_mute = find_client_by_name(trimmed_name);
    if (to_mute == NULL) {
        // Client to mute doesn't exist - but mute$ doesn't send errors
-       return;
+       return -1;
    }
    
    // We need write lock because we're modifying the client's muted list
-   pthread_rwlock_wrlock(&client_list.lock);
+   client_list_write_lock();
    
-   int result = add_muted_client(requester, trimmed_name);
+   int result = add_muted_client(sender, trimmed_name);
    
-   pthread_rwlock_unlock(&client_list.lock);
-   
-   // Update requester's activity time
-   update_client_active_time(client_address);
+   client_list_unlock();
    
     // Note: Per requirements, mute$ sends NO response to client
     // The effect will be seen in future broadcasts (they won't receive messages from muted client)
+    return 0;
 }
 
 // Handle unmute$ command - remove a client from requester's muted list
-void handle_unmute(const char *content, struct sockaddr_in *client_address, int socket_descriptor) {
+int handle_unmute(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor) {
+    (void)client_address;
+    (void)socket_descriptor;
     // Validate content length
-    size_t len = strlen(content);
-    if (len == 0 || len >= MAX_NAME_LEN) {
+    if (content.length == 0 || content.length >= MAX_NAME_LEN) {
         // Invalid - unmute$ doesn't send error responses, so return silently
-        return;
+        return -1;
     }
     
     // Trim the content to get the name to unmute
-    char unmuted_name[MAX_NAME_LEN];
-    strncpy(unmuted_name, content, MAX_NAME_LEN - 1);
-    unmuted_name[MAX_NAME_LEN - 1] = '\0';
-    char *trimmed_name = trim(unmuted_name);
-    
-    // Find the requester (who wants to unmute someone)
-    client_node_t *requester = find_client_by_address(client_address);
-    if (requester == NULL) {
-        // Client not connected - unmute$ doesn't send errors
-        return;
-    }
+    str_view_t trimmed_name = view_trim(content);
     
     // We need write lock because we're modifying the client's muted list
-    pthread_rwlock_wrlock(&client_list.lock);
+    client_list_write_lock();
     
     // Remove from muted list
-    int result = remove_muted_client(requester, trimmed_name);
+    int result = remove_muted_client(sender, trimmed_name);
     
-    pthread_rwlock_unlock(&client_list.lock);
-    
-    // Update requester's activity time
-    update_client_active_time(client_address);
+    client_list_unlock();
     
     // Note: Per requirements, unmute$ sends NO response to client
     // Effect will be seen in future broadcasts (they'll receive messages again)
+    return 0;
 }
 
 // Function to handle rename$ command - change a client's chat name
-void handle_rename(const char *content, struct sockaddr_in *client_address, int socket_descriptor) {
+int handle_rename(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor) {
+    (void)sender;
     // Validate content length
-    size_t len = strlen(content);
-    if (len == 0 || len >= MAX_NAME_LEN) {
+    if (content.length == 0 || content.length >= MAX_NAME_LEN) {
         char error_msg[BUFFER_SIZE];
         snprintf(error_msg, BUFFER_SIZE, "Error$ No name provided or name too long. Expected 'rename$ [NEW_NAME]'\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
     }
 
     // Trim the new name
-    char new_name[MAX_NAME_LEN];
-    strncpy(new_name, content, MAX_NAME_LEN - 1);
-    new_name[MAX_NAME_LEN - 1] = '\0';
-    char *trimmed_name = trim(new_name);
+    str_view_t trimmed_name = view_trim(content);
+
+    // The checks and the rename happen under one write lock, so nobody can take the name in between
+    client_list_write_lock();
 
-    // Find the requester client (who wants to rename)
-    client_node_t *requester = find_client_by_address(client_address);
+    // Look the requester up again under the lock: they may have left since the request was dispatched
+    client_node_t *requester = find_client_by_address_locked(client_address);
     if (requester == NULL) {
+        client_list_unlock();
         char error_msg[BUFFER_SIZE];
         snprintf(error_msg, BUFFER_SIZE, "Error$ You are not connected. Please connect first using 'conn$ [NAME]'\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
     }
 
     // Check if new name is already in use
-    client_node_t *existing = find_client_by_name(trimmed_name);
+    client_node_t *existing = find_client_by_name_locked(trimmed_name);
     if (existing != NULL && existing != requester) {
+        client_list_unlock();
         // Name already taken by someone else
         char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, "Error$ Name '%s' already in use. Please choose another name\n", trimmed_name);
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+        snprintf(error_msg, BUFFER_SIZE, "Error$ Name '%.*s' already in use. Please choose another name\n", (int)trimmed_name.length, trimmed_name.data);
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
     }
 
     // Check if they're trying to rename the same name
-    if (strcmp(requester->client_name, trimmed_name) == 0) {
+    if (existing == requester) {
+        client_list_unlock();
+        char error_msg[BUFFER_SIZE];
+        snprintf(error_msg, BUFFER_SIZE, "Error$ You are already named '%.*s'\n", (int)trimmed_name.length, trimmed_name.data);
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+
+    // Keep the old name for debugging (it stays valid until this request's epoch_exit)
+    const char *old_name = requester->client_name;
+
+    // Once all checks pass, update the name (and the name index with it)
+    if (rename_client_locked(requester, trimmed_name) != 0) {
+        client_list_unlock();
+        char error_msg[BUFFER_SIZE];
+        snprintf(error_msg, BUFFER_SIZE, "Error$ Server is out of memory, rename failed\n");
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+
+    client_list_unlock(); // Unlock
+    
+   // Send success confirmation
+   char response[BUFFER_SIZE];
+   snprintf(response, BUFFER_SIZE, "rename$ You are now known as %.*s\n", (int)trimmed_name.length, trimmed_name.data);
+   send_reply(socket_descriptor, client_address, response, strlen(response));
+   
+   LOG_DEBUG("Client '%s' renamed to '%.*s'\n", old_name, (int)trimmed_name.length, trimmed_name.data);
+   return 0;
+}
+
+// Handle the kick$ command - remove a client from the server
+int handle_kick(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor) {
+    // Validate content length
+    if (content.length == 0 || content.length >= MAX_NAME_LEN) {
+        char error_msg[BUFFER_SIZE];
+        snprintf(error_msg, BUFFER_SIZE, "Error$ No name provided or name too long. Expected 'kick$ [CLIENT_NAME]'\n");
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+    
+    // Trim the name to kick
+    str_view_t trimmed_name = view_trim(content);
+    
+    // Find the client to kick
+    client_node_t *to_kick = find_client_by_name(trimmed_name);
+    if (to_kick == NULL) {
+        char error_msg[BUFFER_SIZE];
+        snprintf(error_msg, BUFFER_SIZE, "Error$ User '%.*s' not found\n", (int)trimmed_name.length, trimmed_name.data);
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+    
+    // Check if admin is trying to kick themselves (optional)
+    if (to_kick == sender) {
         char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, "Error$ You are already named '%s'\n", trimmed_name);
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        snprintf(error_msg, BUFFER_SIZE, "Error$ You cannot kick yourself\n");
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        return -1;
+    }
+    
+    // Store kicked client's address before we remove them
+    struct sockaddr_in kicked_address = to_kick->client_address;
+    
+    // Send removal message to the kicked client
+    char kick_msg[BUFFER_SIZE];
+    snprintf(kick_msg, BUFFER_SIZE, "kick$ You have been removed from the chat\n");
+    send_message(socket_descriptor, &kicked_address, to_kick->wire_format, kick_msg, strlen(kick_msg));
+    
+    // Remove client from list (remove_client_by_address will clean up muted list)
+    remove_client_by_address(&kicked_address);
+    
+    // Broadcast removal message to all remaining clients
+    char broadcast_msg[BUFFER_SIZE];
+    snprintf(broadcast_msg, BUFFER_SIZE, "say$ System: %.*s has been removed from the chat\n", (int)trimmed_name.length, trimmed_name.data);
+    
+    // Broadcast to all remaining clients
+    broadcast_message(broadcast_msg, NULL, NULL, socket_descriptor);
+    
+    LOG_DEBUG("Admin '%s' kicked '%.*s'\n", sender->client_name, (int)trimmed_name.length, trimmed_name.data);
+    return 0;
+}
+
+// Handle ret-ping$ command - client responds to our ping
+int handle_ret_ping(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor) {
+    (void)content;
+    (void)client_address;
+    (void)socket_descriptor;
+    // Client is responding to our ping - they're still alive!
+    // The dispatcher updates their activity time, so when their ping timer expires it sees activity
+    // after the ping and goes back to waiting for inactivity
+    LOG_DEBUG("Client '%s' responded to ping\n", sender->client_name);
+    
+    // No response needed - ping/ret-ping is silent
+    return 0;
+}
+
+// Append one line to a stats report, unless it does not fit
+// Returns the report's new length
+int append_stats_line(char *buffer, int capacity, int n, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer + n, capacity - n, format, args);
+    va_end(args);
+    if (length < 0 || n + length >= capacity) {
+        buffer[n] = '\0';
+        return n;
+    }
+    return n + length;
+}
+
+// Write the current metrics into buffer as lines of space separated key=value pairs, each line starting with
+// what it describes: "server", "broadcast", then "command" for every command that has been used and "lock" for
+// every shared lock that has been taken
+// Returns the report's length
+int format_stats_report(char *buffer, int capacity) {
+    stats_counters_t *totals = (stats_counters_t *)malloc(sizeof(stats_counters_t));
+    if (totals == NULL) {
+        buffer[0] = '\0';
+        return 0;
+    }
+    stats_collect(totals);
+
+    client_list_read_lock();
+    uint32_t client_count = client_list.count;
+    client_list_unlock();
+
+    // Requests waiting for a worker (thread mode only: an event loop has no request queue)
+    int queue_depth = 0;
+    if (shards != NULL && !server_config.event_loop) {
+        for (int i = 0; i < server_config.listener_count; i++) {
+            pthread_mutex_lock(&shards[i].queue.lock);
+            queue_depth += shards[i].queue.count;
+            pthread_mutex_unlock(&shards[i].queue.lock);
+        }
+    }
+
+    int n = append_stats_line(buffer, capacity, 0,
+                              "server uptime_s=%ld clients=%u queue_depth=%d unknown_commands=%llu invalid_requests=%llu send_failures=%llu\n",
+                              (long)(time(NULL) - stats_start_time), client_count, queue_depth,
+                              (unsigned long long)totals->unknown_commands, (unsigned long long)totals->invalid_requests,
+                              (unsigned long long)totals->send_failures);
+    n = append_stats_line(buffer, capacity, n, "broadcast count=%llu recipients=%llu fanout_p50=%llu fanout_p99=%llu fanout_max=%llu\n",
+                          (unsigned long long)totals->broadcasts, (unsigned long long)totals->broadcast_recipients,
+                          (unsigned long long)stats_percentile(totals->fanout, 0.5),
+                          (unsigned long long)stats_percentile(totals->fanout, 0.99),
+                          (unsigned long long)stats_percentile(totals->fanout, 1.0));
+    for (int op = 1; op < WIRE_OP_COUNT; op++) {
+        if (totals->requests[op] == 0) {
+            continue;
+        }
+        n = append_stats_line(buffer, capacity, n, "command name=%s requests=%llu errors=%llu p50_ns=%llu p90_ns=%llu p99_ns=%llu max_ns=%llu\n",
+                              wire_command_names[op], (unsigned long long)totals->requests[op], (unsigned long long)totals->errors[op],
+                              (unsigned long long)stats_percentile(totals->latency[op], 0.5),
+                              (unsigned long long)stats_percentile(totals->latency[op], 0.9),
+                              (unsigned long long)stats_percentile(totals->latency[op], 0.99),
+                              (unsigned long long)stats_percentile(totals->latency[op], 1.0));
+    }
+    for (int lock = 0; lock < STATS_LOCK_COUNT; lock++) {
+        if (totals->lock_acquisitions[lock] == 0) {
+            continue;
+        }
+        n = append_stats_line(buffer, capacity, n, "lock name=%s acquisitions=%llu contended=%llu wait_ns=%llu\n",
+                              stats_lock_names[lock], (unsigned long long)totals->lock_acquisitions[lock],
+                              (unsigned long long)totals->lock_contended[lock], (unsigned long long)totals->lock_wait_ns[lock]);
+    }
+    free(totals);
+    return n;
+}
+
+// Handle the stats$ command (admin only) - reply with the metrics report
+// The report is split at line boundaries into as many stats$ datagrams as it needs
+int handle_stats(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor) {
+    (void)content;
+    char report[STATS_REPORT_MAX];
+    int report_length = format_stats_report(report, sizeof(report));
+
+    const char *prefix = "stats$ ";
+    int prefix_length = strlen(prefix);
+    const char *line = report;
+    const char *end = report + report_length;
+    while (line < end) {
+        char datagram[BUFFER_SIZE];
+        memcpy(datagram, prefix, prefix_length);
+        int datagram_length = prefix_length;
+        while (line < end) {
+            const char *line_end = (const char *)memchr(line, '\n', end - line) + 1;
+            int line_length = line_end - line;
+            // A line always fits on its own: append_stats_line keeps them short
+            if (datagram_length > prefix_length && datagram_length + line_length > BUFFER_SIZE - 1) {
+                break;
+            }
+            memcpy(datagram + datagram_length, line, line_length);
+            datagram_length += line_length;
+            line = line_end;
+        }
+        send_reply(socket_descriptor, client_address, datagram, datagram_length);
+    }
+    LOG_DEBUG("Admin '%s' asked for stats\n", sender->client_name);
+    return 0;
+}
+
+// Periodic dump of the metrics report (-M), appended to stats_file with a "snapshot time=<unix time>" line first
+FILE *stats_file;
+
+void dump_stats() {
+    if (stats_file == NULL) {
         return;
     }
+    char report[STATS_REPORT_MAX];
+    format_stats_report(report, sizeof(report));
+    fprintf(stats_file, "snapshot time=%ld\n%s", (long)time(NULL), report);
+    fflush(stats_file);
+}
+
+// What dispatch_command checks before and after calling a command's handler
+#define COMMAND_REQUIRES_CONN 0x1    // Sender must be connected; the handler gets their node
+#define COMMAND_ADMIN_ONLY 0x2       // Sender must be an admin (only checked with COMMAND_REQUIRES_CONN)
+#define COMMAND_UPDATES_ACTIVITY 0x4 // A request the handler carried out counts as activity
+#define COMMAND_NO_REPLY 0x8         // Rejected silently, without an Error$ (mute$, unmute$, ret-ping$)
 
-    // Store old name for debugging
-    char old_name[MAX_NAME_LEN];
-    strncpy(old_name, requester->client_name, MAX_NAME_LEN - 1);
-    old_name[MAX_NAME_LEN - 1] = '\0';
+// Handlers return 0 if they carried out the request, -1 if they rejected it
+// sender is the requesting client for COMMAND_REQUIRES_CONN commands, NULL otherwise
+typedef int (*command_handler_t)(str_view_t content, client_node_t *sender, struct sockaddr_in *client_address, int socket_descriptor);
 
-    // We need to write lock to modify the client's name
-    pthread_rwlock_wrlock(&client_list.lock);
+typedef struct {
+    command_handler_t handler; // NULL for opcodes only the server sends
+    int flags;
+} command_t;
+
+// Every request the server accepts, by wire opcode (chat_wire.h), so both a frame and a text request
+// (whose command name wire_opcode_for hashes to its opcode) reach their handler with one table lookup.
+// Adding a request means adding its opcode to chat_wire.h and its entry here
+const command_t command_table[WIRE_OP_COUNT] = {
+    [WIRE_OP_CONN]     = {handle_conn,     0},
+    [WIRE_OP_RECONN]   = {handle_reconn,   0},
+    [WIRE_OP_SAY]      = {handle_say,      COMMAND_REQUIRES_CONN | COMMAND_UPDATES_ACTIVITY},
+    [WIRE_OP_SAYTO]    = {handle_sayto,    COMMAND_REQUIRES_CONN | COMMAND_UPDATES_ACTIVITY},
+    [WIRE_OP_DISCONN]  = {handle_disconn,  0},
+    [WIRE_OP_MUTE]     = {handle_mute,     COMMAND_REQUIRES_CONN | COMMAND_UPDATES_ACTIVITY | COMMAND_NO_REPLY},
+    [WIRE_OP_UNMUTE]   = {handle_unmute,   COMMAND_REQUIRES_CONN | COMMAND_UPDATES_ACTIVITY | COMMAND_NO_REPLY},
+    [WIRE_OP_RENAME]   = {handle_rename,   COMMAND_REQUIRES_CONN},
+    [WIRE_OP_KICK]     = {handle_kick,     COMMAND_REQUIRES_CONN | COMMAND_ADMIN_ONLY | COMMAND_UPDATES_ACTIVITY},
+    [WIRE_OP_RET_PING] = {handle_ret_ping, COMMAND_REQUIRES_CONN | COMMAND_UPDATES_ACTIVITY | COMMAND_NO_REPLY},
+    [WIRE_OP_STATS]    = {handle_stats,    COMMAND_REQUIRES_CONN | COMMAND_ADMIN_ONLY},
+    [WIRE_OP_JOIN]     = {handle_join,     COMMAND_REQUIRES_CONN | COMMAND_UPDATES_ACTIVITY},
+    [WIRE_OP_LEAVE]    = {handle_leave,    COMMAND_REQUIRES_CONN | COMMAND_UPDATES_ACTIVITY},
+};
 
-    // Once all checks pass, update the name
-    strncpy(requester->client_name, trimmed_name, MAX_NAME_LEN - 1);
-    requester->client_name[MAX_NAME_LEN - 1] = '\0';
+// "conn, reconn, ..." for the unknown command error, built from command_table at startup
+char supported_commands[256];
 
-    pthread_rwlock_unlock(&client_list.lock); // Unlock
-    
-   // Send success confirmation
-   char response[BUFFER_SIZE];
-   snprintf(response, BUFFER_SIZE, "rename$ You are now known as %s\n", trimmed_name);
-   udp_socket_write(socket_descriptor, client_address, response, strlen(response));
-   
-   printf("[DEBUG] Client '%s' renamed to '%s'\n", old_name, trimmed_name);
+void init_command_table() {
+    wire_init_opcode_index();
+    int n = 0;
+    for (int op = 1; op < WIRE_OP_COUNT; op++) {
+        if (command_table[op].handler != NULL) {
+            n += snprintf(supported_commands + n, sizeof(supported_commands) - n, "%s%s", n > 0 ? ", " : "", wire_command_names[op]);
+        }
+    }
 }
 
-// Handle the kick$ command - remove a client from the server
-void handle_kick(const char *content, struct sockaddr_in *client_address, int socket_descriptor) {
-    // Validate content length
-    size_t len = strlen(content);
-    if (len == 0 || len >= MAX_NAME_LEN) {
-        char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, "Error$ No name provided or name too long. Expected 'kick$ [CLIENT_NAME]'\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+// Run a known command: the checks its flags ask for, then its handler
+// Returns 0 if the request was carried out, -1 if it was rejected
+int run_command(int opcode, str_view_t content, struct sockaddr_in *client_address, int socket_descriptor) {
+    const command_t *command = &command_table[opcode];
+
+    client_node_t *sender = NULL;
+    if (command->flags & COMMAND_REQUIRES_CONN) {
+        sender = find_client_by_address(client_address);
+        //We can't find the client in the client list. Therefore, send error to client and ask to connect first
+        if (sender == NULL) {
+            if (!(command->flags & COMMAND_NO_REPLY)) {
+                char error_msg[BUFFER_SIZE];
+                snprintf(error_msg, BUFFER_SIZE, "Error$ You have not connected to server yet. Please connect to server using 'conn$ [NAME].\n");
+                send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+            }
+            return -1;
+        }
+        if ((command->flags & COMMAND_ADMIN_ONLY) && !sender->is_admin) {
+            char error_msg[BUFFER_SIZE];
+            snprintf(error_msg, BUFFER_SIZE, "Error$ Only admin can use %s$\n", wire_command_names[opcode]);
+            send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
+            return -1;
+        }
     }
-    
-    // Trim the name to kick
-    char kicked_name[MAX_NAME_LEN];
-    strncpy(kicked_name, content, MAX_NAME_LEN - 1);
-    kicked_name[MAX_NAME_LEN - 1] = '\0';
-    char *trimmed_name = trim(kicked_name);
-    
-    // Find the requester (who wants to kick someone)
-    client_node_t *requester = find_client_by_address(client_address);
-    if (requester == NULL) {
-        char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, "Error$ You are not connected. Please connect first\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-        return;
+
+    if (command->handler(content, sender, client_address, socket_descriptor) != 0) {
+        return -1;
     }
-    
-    // Check if requester is admin (port 6666)
-    // The is_admin flag is set during conn$, but let's also check port directly for safety
-    int requester_port = ntohs(client_address->sin_port);
-    if (requester_port != 6666 && !requester->is_admin) {
+    if (command->flags & COMMAND_UPDATES_ACTIVITY) {
+        update_client_active_time(client_address);
+    }
+    return 0;
+}
+
+// Run the command for an opcode (0 or one without a handler: reply with the supported commands)
+// Every dispatched request is counted in the stats, with how long it took
+void dispatch_command(int opcode, str_view_t command_name, str_view_t content, struct sockaddr_in *client_address, int socket_descriptor) {
+    if (opcode <= 0 || opcode >= WIRE_OP_COUNT || command_table[opcode].handler == NULL) {
+        stats_record_event(unknown_commands);
+        LOG_DEBUG("Unknown command type: '%.*s'\n", (int)command_name.length, command_name.data);
         char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, "Error$ Only admin can kick users\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        snprintf(error_msg, BUFFER_SIZE, "Error$ Unknown command '%.*s'. Supported: %s\n", (int)command_name.length, command_name.data,
+                 supported_commands);
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
         return;
     }
-    
-    // Find the client to kick
-    client_node_t *to_kick = find_client_by_name(trimmed_name);
-    if (to_kick == NULL) {
+
+    uint64_t start_ns = stats_now_ns();
+    int rc = run_command(opcode, content, client_address, socket_descriptor);
+    stats_record_request(opcode, rc != 0, stats_now_ns() - start_ns);
+}
+
+// Route a binary frame (see chat_wire.h) to the handler for its opcode
+// The handler gets the payload as a view into the datagram (a request is one frame; anything after it is ignored)
+void route_frame(const char *frame, int length, struct sockaddr_in *client_address, int socket_descriptor) {
+    request_format = WIRE_BINARY;
+
+    wire_header_t header;
+    if (wire_decode(frame, length, &header) != 0 || header.flags != 0) {
+        stats_record_event(invalid_requests);
         char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, "Error$ User '%s' not found\n", trimmed_name);
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        snprintf(error_msg, BUFFER_SIZE, "Error$ Invalid frame\n");
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
         return;
     }
-    
-    // Check if admin is trying to kick themselves (optional)
-    if (to_kick == requester) {
+    str_view_t content = { frame + WIRE_HEADER_SIZE, header.length };
+    if (memchr(content.data, '\0', content.length) != NULL) {
+        stats_record_event(invalid_requests);
         char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, "Error$ You cannot kick yourself\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        snprintf(error_msg, BUFFER_SIZE, "Error$ Invalid frame: the payload contains a zero byte\n");
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
         return;
     }
-    
-    // Store kicked client's address before we remove them
-    struct sockaddr_in kicked_address = to_kick->client_address;
-    
-    // Send removal message to the kicked client
-    char kick_msg[BUFFER_SIZE];
-    snprintf(kick_msg, BUFFER_SIZE, "kick$ You have been removed from the chat\n");
-    udp_socket_write(socket_descriptor, &kicked_address, kick_msg, strlen(kick_msg));
-    
-    // Remove client from list (remove_client_by_address will clean up muted list)
-    remove_client_by_address(&kicked_address);
-    
-    // Broadcast removal message to all remaining clients
-    char broadcast_msg[BUFFER_SIZE];
-    snprintf(broadcast_msg, BUFFER_SIZE, "say$ System: %s has been removed from the chat\n", trimmed_name);
-    
-    // Broadcast to all remaining clients
-    pthread_rwlock_rdlock(&client_list.lock);
-    client_node_t *current = client_list.head;
-    while (current != NULL) {
-        udp_socket_write(socket_descriptor, &current->client_address, broadcast_msg, strlen(broadcast_msg));
-        current = current->next;
-    }
-    pthread_rwlock_unlock(&client_list.lock);
-    
-    // Update admin's activity time
-    update_client_active_time(client_address);
-    
-    printf("[DEBUG] Admin '%s' kicked '%s'\n", requester->client_name, trimmed_name);
-}
 
-// Handle ret-ping$ command - client responds to our ping
-void handle_ret_ping(const char *content, struct sockaddr_in *client_address, int socket_descriptor) {
-    // Client is responding to our ping - they're still alive!
-    // Find the client and update their active time
-    client_node_t *client = find_client_by_address(client_address);
-    
-    if (client != NULL) {
-        // Update their activity time (they responded, so they're active)
-        update_client_active_time(client_address);
-        
-        // Remove them from ping tracking list (they responded)
-        remove_ping_tracker(client_address);
-        
-        printf("[DEBUG] Client '%s' responded to ping\n", client->client_name);
-    } else {
-        // Client not in list (maybe already removed?) - just remove from ping list
-        remove_ping_tracker(client_address);
-    }
-    
-    // No response needed - ping/ret-ping is silent
+    request_seq = header.seq;
+    dispatch_command(header.opcode, view_of(wire_command_names[header.opcode]), content, client_address, socket_descriptor);
 }
 
 // Route parsed request to appropriate handler function based on command type
-void route_request(const char *request, struct sockaddr_in *client_address, int socket_descriptor) {
-    char command_type[BUFFER_SIZE];
-    char content[BUFFER_SIZE];
-    
-    int parse_rc = parse_request(request, command_type, content);
+// Binary frames go to route_frame; anything else is a "command$content" text request
+void route_request(const char *request, int length, struct sockaddr_in *client_address, int socket_descriptor) {
+    if (length > 0 && (unsigned char)request[0] == WIRE_VERSION) {
+        // A frame's header holds zero and control bytes, so only its opcode and size are logged
+        LOG_DEBUG("Handling frame: opcode %d, %d bytes\n", length > 1 ? (unsigned char)request[1] : -1, length);
+        route_frame(request, length, client_address, socket_descriptor);
+        return;
+    }
+    request_format = WIRE_TEXT;
+
+    // A text request ends at its first zero byte, as it always has
+    str_view_t command_type;
+    str_view_t content;
+    str_view_t text = { request, strnlen(request, length) };
+    LOG_DEBUG("Handling request: %.*s\n", (int)text.length - (text.length > 0 && text.data[text.length - 1] == '\n'), text.data);
+
+    int parse_rc = parse_request(text, &command_type, &content);
 
     if (parse_rc != 0) {
+        stats_record_event(invalid_requests);
         char error_msg[BUFFER_SIZE];
         snprintf(error_msg, BUFFER_SIZE, "Error$ Invalid request format. Expected 'command$content'\n");
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
+        send_reply(socket_descriptor, client_address, error_msg, strlen(error_msg));
         return;
     }
-    
-    // Trim command type and content
-    char *trimmed_command = trim(command_type);
-    char *trimmed_content = trim(content);
-    
-    if (strcmp(trimmed_command, "conn") == 0) {
-        printf("[DEBUG] Routing to handle_conn\n");
-        fflush(stdout);
-        handle_conn(trimmed_content, client_address, socket_descriptor);
-    } else if (strcmp(trimmed_command, "say") == 0) {
-        printf("[DEBUG] Routing to handle_say\n");
-        fflush(stdout);
-        handle_say(trimmed_content, client_address, socket_descriptor);        
-    } else if (strcmp(trimmed_command, "sayto") == 0) {
-        printf("[DEBUG] Routing to handle_sayto\n");
-        handle_sayto(trimmed_content, client_address, socket_descriptor); 
-    } else if (strcmp(trimmed_command, "disconn") == 0) {
-        printf("[DEBUG] Routing to handle_disconn");
-        handle_disconn(trimmed_content, client_address, socket_descriptor);
-    } else if (strcmp(trimmed_command, "mute") == 0) {
-        printf("[DEBUG] Routing to handle_mute\n");
-        handle_mute(trimmed_content, client_address, socket_descriptor);
-    } else if (strcmp(trimmed_command, "unmute") == 0) {
-        printf("[DEBUG] Routing to handle_unmute\n");
-        handle_unmute(trimmed_content, client_address, socket_descriptor);
-    } else if (strcmp(trimmed_command, "rename") == 0) {
-        printf("[DEBUG] Routing to handle_rename\n");
-        handle_rename(trimmed_content, client_address, socket_descriptor);
-    } else if (strcmp(trimmed_command, "kick") == 0) {
-        printf("[DEBUG] Routing to handle_kick\n");
-        handle_kick(trimmed_content, client_address, socket_descriptor);
-    } else if (strcmp(trimmed_command, "ret-ping") == 0) {
-        printf("[DEBUG] Routing to handle_ret_ping\n");
-        handle_ret_ping(trimmed_content, client_address, socket_descriptor);
-    } else {
-        printf("[DEBUG] Unknown command type: '%s'\n", trimmed_command);
-        char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, 
-                 "Error$ Unknown command '%s'. Supported: conn, say, sayto, disconn, mute, unmute, rename, kick\n", trimmed_command);
-        udp_socket_write(socket_descriptor, client_address, error_msg, strlen(error_msg));
-    }
+
+    dispatch_command(wire_opcode_for(command_type.data, command_type.length), command_type, content, client_address, socket_descriptor);
 }
 
-// Worker thread function that processes a single client request
-void *handle_request(void *arg) {
-    request_handler_t *handler_data = (request_handler_t *)arg;
-    char *request = handler_data->request;
-    struct sockaddr_in client_address = handler_data->client_address;
-    int sd = handler_data->socket_descriptor;
-    
-    printf("[DEBUG] Worker thread handling request: %s\n", request);
-    route_request(request, &client_address, sd);
-    free(handler_data);
+// Process a single client request taken off the request queue
+void handle_request(request_handler_t *handler_data) {
+    // Client nodes the handler looks up stay valid until epoch_exit, even if another thread removes them
+    epoch_enter();
+    route_request(handler_data->request, handler_data->request_length, &handler_data->client_address, handler_data->socket_descriptor);
+    epoch_exit();
+}
+
+// Worker thread - one of a fixed pool of long-lived threads that serve requests from the queue
+void *worker_thread(void *arg) {
+    request_queue_t *queue = (request_queue_t *)arg;
+    request_handler_t handler_data;
+
+    while (1) {
+        request_queue_pop(queue, &handler_data);
+        handle_request(&handler_data);
+    }
     return NULL;
 }
 
-// Listener thread that continuously waits for incoming requests and spawns worker threads
+// Listener thread that continuously waits for incoming requests and hands them to the worker pool
+// Datagrams are received in batches (one recvmmsg call) and pushed to the queue as a batch
 void *listener_thread(void *arg) {
-    int sd = *(int *)arg;
-    printf("[DEBUG] Listener thread started, waiting for requests on port %d...\n", SERVER_PORT);
-    fflush(stdout);
+    server_shard_t *shard = (server_shard_t *)arg;
+    int sd = shard->socket_descriptor;
+    LOG_INFO("Listener thread %d started, waiting for requests on port %d...\n", shard->index, SERVER_PORT);
+
+    // Batch buffers are reused for every recvmmsg call
+    char client_requests[UDP_BATCH_SIZE][BUFFER_SIZE];
+    int request_lengths[UDP_BATCH_SIZE];
+    struct sockaddr_in client_addresses[UDP_BATCH_SIZE];
     
     while (1) {
-        char client_request[BUFFER_SIZE];
-        struct sockaddr_in client_address;
-        int rc = udp_socket_read(sd, &client_address, client_request, BUFFER_SIZE-1);
+        int rc = udp_socket_read_batch(sd, client_addresses, client_requests, request_lengths, UDP_BATCH_SIZE);
         
         if (rc > 0) {
-            client_request[rc] = '\0';
-            printf("[DEBUG] Received request (%d bytes) from client\n", rc);
-            fflush(stdout);
-
-            request_handler_t *handler_data = (request_handler_t *)malloc(sizeof(request_handler_t));
-            if (handler_data == NULL) {
-                fprintf(stderr, "Failed to allocate memory for handler data\n");
-                continue;
-            }
+            LOG_DEBUG("Received batch of %d request(s) from clients\n", rc);
 
-            //use memcpy for cleaner buffer use
-            memcpy(handler_data->request, client_request, rc);
-            handler_data->request[rc] = '\0';
-            handler_data->client_address = client_address;
-            handler_data->socket_descriptor = sd;
-            
-            pthread_t worker_tid;
-            int thread_rc = pthread_create(&worker_tid, NULL, handle_request, handler_data);
-            if (thread_rc != 0) {
-                fprintf(stderr, "Failed to create worker thread\n");
-                free(handler_data);
-                continue;
+            int dropped = request_queue_push_batch(&shard->queue, client_requests, request_lengths, client_addresses, rc, sd);
+            if (dropped > 0) {
+                LOG_INFO("Request queue full, dropped %d request(s)\n", dropped);
             }
-            
-            pthread_detach(worker_tid);
         } else if (rc < 0) {
             fprintf(stderr, "Error reading from socket\n");
         }
@@ -1239,178 +3569,606 @@ void *listener_thread(void *arg) {
     return NULL;
 }
 
-// Monitoring thread that checks for inactive clients and pings them
+// Remove clients whose ping timed out without an answer, TIMER_REMOVAL_BATCH per write-lock section,
+// and announce each removal (caller must be inside an epoch, so removed nodes stay readable)
+void remove_unanswered_clients(client_timer_t *unanswered, int socket_descriptor) {
+    while (unanswered != NULL) {
+        client_node_t *removed[TIMER_REMOVAL_BATCH];
+        int removed_count = 0;
+
+        client_list_write_lock();
+        while (unanswered != NULL && removed_count < TIMER_REMOVAL_BATCH) {
+            client_timer_t *timer = unanswered;
+            unanswered = timer->next;
+
+            client_node_t *client = find_client_by_id_locked(timer->client_id);
+            if (client == NULL || client->generation != timer->generation) {
+                slab_free(&client_timer_slab, timer); // Left on their own meanwhile
+                continue;
+            }
+            time_t last_active = atomic_load_explicit(&client_list.hot[client->hot_index].last_active_time, memory_order_relaxed);
+            if (last_active >= timer->armed_time) {
+                // Answered while we waited for the write lock
+                timer->kind = TIMER_INACTIVITY;
+                timer->armed_time = coarse_now();
+                timer->deadline = last_active + INACTIVITY_THRESHOLD;
+                timer_wheel_schedule(&client_timers, timer);
+                continue;
+            }
+
+            LOG_DEBUG("Client '%s' did not respond to ping, removing...\n", client->client_name);
+            remove_client_node_locked(client);
+            removed[removed_count++] = client;
+            slab_free(&client_timer_slab, timer);
+        }
+        client_list_unlock();
+
+        // Broadcast removal messages once the removed clients are out of the snapshot
+        for (int i = 0; i < removed_count; i++) {
+            char broadcast_msg[BUFFER_SIZE];
+            snprintf(broadcast_msg, BUFFER_SIZE, "say$ System: %s has been removed due to inactivity\n", removed[i]->client_name);
+            broadcast_message(broadcast_msg, NULL, NULL, socket_descriptor);
+        }
+    }
+}
+
+// Ping clients whose inactivity timer expired, and remove clients whose ping went unanswered
+// Called every CLOCK_TICK_INTERVAL by the monitor thread or the event loop's timer
+// Only expired timers are looked at, so the cost follows the number of expirations, not the number of clients.
+// Requests never touch the wheel: an inactivity timer that expires for a client who was active since
+// is simply pushed back to last_active + INACTIVITY_THRESHOLD
+void process_client_timers(int socket_descriptor) {
+    time_t now = coarse_now();
+    client_timer_t *expired = timer_wheel_advance(&client_timers, now);
+    if (expired == NULL) {
+        return;
+    }
+
+    broadcast_targets_t *pings = broadcast_targets;
+    for (int format = 0; format < WIRE_FORMAT_COUNT; format++) {
+        pings[format].count = 0;
+    }
+    client_timer_t *unanswered = NULL;
+
+    epoch_enter();
+    client_list_read_lock();
+    while (expired != NULL) {
+        client_timer_t *timer = expired;
+        expired = timer->next;
+
+        client_node_t *client = find_client_by_id_locked(timer->client_id);
+        if (client == NULL || client->generation != timer->generation) {
+            // The client left after the timer was set
+            slab_free(&client_timer_slab, timer);
+            continue;
+        }
+        time_t last_active = atomic_load_explicit(&client_list.hot[client->hot_index].last_active_time, memory_order_relaxed);
+
+        if (timer->kind == TIMER_INACTIVITY) {
+            if (now - last_active < INACTIVITY_THRESHOLD) {
+                timer->deadline = last_active + INACTIVITY_THRESHOLD;
+            } else {
+                LOG_DEBUG("Client '%s' inactive for %ld seconds, sending ping\n",
+                       client->client_name, (long)(now - last_active));
+                add_broadcast_target(&pings[client->wire_format], &client->client_address);
+                timer->kind = TIMER_PING_TIMEOUT;
+                timer->deadline = now + PING_TIMEOUT;
+            }
+            timer->armed_time = now;
+            timer_wheel_schedule(&client_timers, timer);
+        } else if (last_active >= timer->armed_time) {
+            // Any request since the ping (normally ret-ping$) counts as an answer
+            timer->kind = TIMER_INACTIVITY;
+            timer->armed_time = now;
+            timer->deadline = last_active + INACTIVITY_THRESHOLD;
+            timer_wheel_schedule(&client_timers, timer);
+        } else {
+            timer->next = unanswered;
+            unanswered = timer;
+        }
+    }
+    client_list_unlock();
+
+    // Every ping due on this tick goes out in one sendmmsg batch per wire format
+    char ping_msg[] = "ping$\n";
+    send_to_targets(socket_descriptor, pings, ping_msg, strlen(ping_msg));
+
+    if (unanswered != NULL) {
+        remove_unanswered_clients(unanswered, socket_descriptor);
+    }
+    epoch_exit();
+}
+
+// Print how each shard's request queue coped since startup (thread mode only)
+void report_queue_stats() {
+    for (int i = 0; i < server_config.listener_count; i++) {
+        request_queue_t *queue = &shards[i].queue;
+        pthread_mutex_lock(&queue->lock);
+        unsigned long received = queue->enqueued + queue->dropped_newest;
+        double average_batch = queue->batches > 0 ? (double)received / queue->batches : 0.0;
+        LOG_INFO("Shard %d request queue: %d/%d queued, %lu enqueued, %lu dropped (newest), %lu dropped (oldest), average batch %.2f\n",
+               i, queue->count, queue->capacity, queue->enqueued,
+               queue->dropped_newest, queue->dropped_oldest, average_batch);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+// Print live and free object counts for every slab
+void report_slab_stats() {
+    slab_t *slabs[] = {&client_slab, &muted_name_slab, &client_timer_slab, &outbound_slab};
+    for (size_t i = 0; i < sizeof(slabs) / sizeof(slabs[0]); i++) {
+        slab_stats_t stats = slab_get_stats(slabs[i]);
+        LOG_INFO("Slab %s: %zu live, %zu free, %zu bytes reserved\n",
+               slabs[i]->name, stats.live, stats.free, stats.total * slabs[i]->object_size);
+    }
+    for (int i = 0; i < NAME_STORE_CLASSES; i++) {
+        slab_stats_t stats = slab_get_stats(&name_store_slabs[i]);
+        LOG_INFO("Name store (%zu bytes): %zu live, %zu free\n",
+               name_store_class_sizes[i], stats.live, stats.free);
+    }
+    LOG_INFO("%zu retired objects waiting for readers to leave their epoch\n", epoch_pending());
+}
+
+// Print how many messages the history keeps and the memory they take
+void report_history_stats() {
+    shared_mutex_lock(&chat_history.lock);
+    LOG_INFO("History: %llu messages, %zu payload bytes in %zu blocks (%zu bytes)\n",
+           (unsigned long long)(chat_history.next_seq - chat_history.first_seq), chat_history.payload_bytes,
+           chat_history.block_count, chat_history.block_count * sizeof(history_block_t));
+    shared_mutex_unlock(&chat_history.lock);
+}
+
+// Print how many clients are connected and how often the client list write lock was taken
+void report_client_list_stats() {
+    static unsigned long last_write_locks;
+    static time_t last_report;
+    unsigned long write_locks = atomic_load_explicit(&client_list_write_locks, memory_order_relaxed);
+    time_t now = coarse_now();
+    double elapsed = now > last_report ? (double)(now - last_report) : 1.0;
+
+    client_list_read_lock();
+    uint32_t count = client_list.count;
+    uint32_t room_count = client_list.room_count;
+    client_list_unlock();
+
+    shared_mutex_lock(&client_timers.lock);
+    size_t pending_timers = client_timers.pending;
+    shared_mutex_unlock(&client_timers.lock);
+
+    LOG_INFO("Client list: %u clients in %u rooms, %zu timers pending, %lu write locks since the last report (%.1f/s)\n",
+           count, room_count, pending_timers, write_locks - last_write_locks, (write_locks - last_write_locks) / elapsed);
+    last_write_locks = write_locks;
+    last_report = now;
+}
+
+// Monitoring thread (thread mode only): every CLOCK_TICK_INTERVAL it refreshes the coarse clock and fires
+// expired client timers, and every MONITOR_INTERVAL it reports stats
 void *monitor_thread(void *arg) {
     int socket_descriptor = *(int *)arg;
-    printf("[DEBUG] Monitor thread started\n");
+    LOG_INFO("Monitor thread started\n");
+
+    unsigned long ticks = 0;
+    while (1) {
+        sleep(CLOCK_TICK_INTERVAL);
+        refresh_coarse_clock();
+        process_client_timers(socket_descriptor);
+
+        if (++ticks % (MONITOR_INTERVAL / CLOCK_TICK_INTERVAL) == 0) {
+            report_queue_stats();
+            report_client_list_stats();
+            epoch_reclaim(); // Frees retired objects even when no writer has run lately
+            report_slab_stats();
+            report_history_stats();
+            dump_stats();
+        }
+    }
     
+    return NULL;
+}
+
+// Event loop for one shard (event loop mode)
+// A single thread waits on epoll for the socket to be readable or writable and for the monitor timer,
+// and runs every handler inline - there is no request queue and no worker hand-off
+void *event_loop_thread(void *arg) {
+    server_shard_t *shard = (server_shard_t *)arg;
+    int sd = shard->socket_descriptor;
+    current_event_loop = shard;
+    LOG_INFO("Event loop %d started, waiting for requests on port %d...\n", shard->index, SERVER_PORT);
+
+    char client_requests[UDP_BATCH_SIZE][BUFFER_SIZE];
+    int request_lengths[UDP_BATCH_SIZE];
+    struct sockaddr_in client_addresses[UDP_BATCH_SIZE];
+    struct epoll_event events[4];
+
     while (1) {
-        // Sleep for the monitoring interval (30 seconds)
-        sleep(MONITOR_INTERVAL);
-        
-        time_t current_time = time(NULL);
-        
-        // Get all clients and check their activity
-        pthread_rwlock_rdlock(&client_list.lock);
-        
-        client_node_t *current = client_list.head;
-        while (current != NULL) {
-            // Calculate how long since last activity
-            time_t time_since_active = current_time - current->last_active_time;
-            
-            // Check if client has been inactive for more than threshold
-            if (time_since_active >= INACTIVITY_THRESHOLD) {
-                // Check if we're already pinging this client
-                pthread_mutex_lock(&ping_list.lock);
-                int already_pinging = 0;
-                ping_tracker_t *ping_current = ping_list.head;
-                while (ping_current != NULL) {
-                    if (ping_current->client_address.sin_addr.s_addr == current->client_address.sin_addr.s_addr &&
-                        ping_current->client_address.sin_port == current->client_address.sin_port) {
-                        already_pinging = 1;
-                        break;
+        int event_count = epoll_wait(shard->epoll_fd, events, 4, -1);
+        if (event_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error$ epoll_wait failed\n");
+            break;
+        }
+
+        for (int e = 0; e < event_count; e++) {
+            if (events[e].data.fd == shard->timer_fd) {
+                uint64_t expirations;
+                if (read(shard->timer_fd, &expirations, sizeof(expirations)) > 0) {
+                    refresh_coarse_clock();
+                    process_client_timers(sd);
+
+                    // The timer ticks every CLOCK_TICK_INTERVAL; stats are reported every MONITOR_INTERVAL
+                    unsigned long ticks_per_report = MONITOR_INTERVAL / CLOCK_TICK_INTERVAL;
+                    unsigned long before = shard->timer_ticks;
+                    shard->timer_ticks += expirations;
+                    if (before / ticks_per_report != shard->timer_ticks / ticks_per_report) {
+                        report_client_list_stats();
+                        epoch_reclaim();
+                        report_slab_stats();
+                        report_history_stats();
+                        dump_stats();
                     }
-                    ping_current = ping_current->next;
                 }
-                pthread_mutex_unlock(&ping_list.lock);
-                
-                // If we're not already pinging them, send a ping
-                if (!already_pinging) {
-                    printf("[DEBUG] Client '%s' inactive for %ld seconds, sending ping\n", 
-                           current->client_name, time_since_active);
-                    
-                    // Send ping message
-                    char ping_msg[BUFFER_SIZE];
-                    snprintf(ping_msg, BUFFER_SIZE, "ping$\n");
-                    udp_socket_write(socket_descriptor, &current->client_address, ping_msg, strlen(ping_msg));
-                    
-                    // Add to ping tracking list
-                    add_ping_tracker(&current->client_address);
+                continue;
+            }
+
+            if (events[e].events & EPOLLOUT) {
+                flush_outbound(shard);
+            }
+
+            if (events[e].events & EPOLLIN) {
+                // Drain a bounded number of batches, then go back to epoll so the timer is not starved
+                for (int round = 0; round < 8; round++) {
+                    int rc = udp_socket_read_batch(sd, client_addresses, client_requests, request_lengths, UDP_BATCH_SIZE);
+                    if (rc <= 0) {
+                        break; // EAGAIN - socket drained
+                    }
+                    epoch_enter();
+                    for (int i = 0; i < rc; i++) {
+                        client_requests[i][request_lengths[i]] = '\0';
+                        route_request(client_requests[i], request_lengths[i], &client_addresses[i], sd);
+                    }
+                    epoch_exit();
+                    if (rc < UDP_BATCH_SIZE) {
+                        break;
+                    }
                 }
             }
-            
-            current = current->next;
         }
-        
-        pthread_rwlock_unlock(&client_list.lock);
-        
-        // Now check for ping timeouts (clients that didn't respond)
-        pthread_mutex_lock(&ping_list.lock);
-        ping_tracker_t *ping_current = ping_list.head;
-        ping_tracker_t *ping_prev = NULL;
-        
-        while (ping_current != NULL) {
-            time_t time_since_ping = current_time - ping_current->ping_time;
-            
-            // If ping timeout exceeded, remove the client
-            if (time_since_ping >= PING_TIMEOUT) {
-                printf("[DEBUG] Client at port %d did not respond to ping, removing...\n", 
-                       ntohs(ping_current->client_address.sin_port));
-                
-                // Find the client node to get their name for broadcast
-                pthread_rwlock_wrlock(&client_list.lock);
-                client_node_t *to_remove = find_client_by_address_locked(&ping_current->client_address);
-                char removed_name[MAX_NAME_LEN] = "Unknown";
-                
-                if (to_remove != NULL) {
-                    strncpy(removed_name, to_remove->client_name, MAX_NAME_LEN - 1);
-                    removed_name[MAX_NAME_LEN - 1] = '\0';
-                }
-                
-                // Remove client from list (lock already held)
-                if (to_remove != NULL) {
-                    remove_client_by_address_locked(&ping_current->client_address);
-                }
-                pthread_rwlock_unlock(&client_list.lock);
-                
-                // Broadcast removal message
-                char broadcast_msg[BUFFER_SIZE];
-                snprintf(broadcast_msg, BUFFER_SIZE, "say$ System: %s has been removed due to inactivity\n", removed_name);
-                
-                pthread_rwlock_rdlock(&client_list.lock);
-                client_node_t *broadcast_current = client_list.head;
-                while (broadcast_current != NULL) {
-                    udp_socket_write(socket_descriptor, &broadcast_current->client_address, 
-                                    broadcast_msg, strlen(broadcast_msg));
-                    broadcast_current = broadcast_current->next;
-                }
-                pthread_rwlock_unlock(&client_list.lock);
-                
-                // Remove from ping list
-                ping_tracker_t *to_free = ping_current;
-                if (ping_prev == NULL) {
-                    ping_list.head = ping_current->next;
-                } else {
-                    ping_prev->next = ping_current->next;
-                }
-                ping_current = ping_current->next;
-                free(to_free);
+    }
+    return NULL;
+}
+
+void print_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [-w workers] [-q queue_capacity] [-o drop|drop-oldest] [-l listeners] [-e] [-H history_depth]\n"
+                    "       [-D history_dir] [-S segment_kb] [-R segments] [-L none|info|debug] [-F log_file]\n"
+                    "       [-M stats_file]\n", program_name);
+    fprintf(stderr, "  -w  number of worker threads per listener (default %d)\n", DEFAULT_WORKER_COUNT);
+    fprintf(stderr, "  -q  request queue capacity per listener (default %d)\n", DEFAULT_QUEUE_CAPACITY);
+    fprintf(stderr, "  -o  what to do when the queue is full: drop the new request (default) or the oldest one\n");
+    fprintf(stderr, "  -l  number of SO_REUSEPORT listener sockets sharing port %d (default 1)\n", SERVER_PORT);
+    fprintf(stderr, "  -e  event loop mode: one epoll loop per listener runs handlers inline (no worker threads)\n");
+    fprintf(stderr, "  -H  chat history messages sent to new clients (default %d)\n", DEFAULT_HISTORY_DEPTH);
+    fprintf(stderr, "  -D  keep the chat history in a log in this directory, so it survives restarts (default off)\n");
+    fprintf(stderr, "  -S  size of each history log segment in KB (default %d)\n", DEFAULT_HISTORY_SEGMENT_KB);
+    fprintf(stderr, "  -R  history log segments kept on disk (default %d)\n", DEFAULT_HISTORY_RETAIN_SEGMENTS);
+    fprintf(stderr, "  -L  log level: none, info (startup and monitor reports, default) or debug (every request)\n");
+    fprintf(stderr, "  -F  append the log to this file instead of stdout\n");
+    fprintf(stderr, "  -M  append the metrics report (see stats$) to this file every %d seconds\n", MONITOR_INTERVAL);
+}
+
+// Parse command line options into server_config
+// Returns 0 on success, -1 if the options are invalid
+int parse_server_options(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "w:q:o:l:eH:D:S:R:L:F:M:")) != -1) {
+        switch (opt) {
+        case 'w':
+            server_config.worker_count = atoi(optarg);
+            if (server_config.worker_count <= 0) {
+                fprintf(stderr, "Error$ worker count must be positive\n");
+                return -1;
+            }
+            break;
+        case 'q':
+            server_config.queue_capacity = atoi(optarg);
+            if (server_config.queue_capacity <= 0) {
+                fprintf(stderr, "Error$ queue capacity must be positive\n");
+                return -1;
+            }
+            break;
+        case 'o':
+            if (strcmp(optarg, "drop") == 0) {
+                server_config.overflow_policy = OVERFLOW_DROP_NEWEST;
+            } else if (strcmp(optarg, "drop-oldest") == 0) {
+                server_config.overflow_policy = OVERFLOW_DROP_OLDEST;
             } else {
-                ping_prev = ping_current;
-                ping_current = ping_current->next;
+                fprintf(stderr, "Error$ unknown overflow policy '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'l':
+            server_config.listener_count = atoi(optarg);
+            if (server_config.listener_count <= 0) {
+                fprintf(stderr, "Error$ listener count must be positive\n");
+                return -1;
+            }
+            break;
+        case 'e':
+            server_config.event_loop = 1;
+            break;
+        case 'H':
+            server_config.history_depth = atoi(optarg);
+            if (server_config.history_depth <= 0) {
+                fprintf(stderr, "Error$ history depth must be positive\n");
+                return -1;
+            }
+            break;
+        case 'D':
+            server_config.history_directory = optarg;
+            break;
+        case 'S':
+            server_config.history_segment_kb = atoi(optarg);
+            if (server_config.history_segment_kb < LOG_MIN_SEGMENT_SIZE / 1024) {
+                fprintf(stderr, "Error$ history segment size must be at least %d KB\n", LOG_MIN_SEGMENT_SIZE / 1024);
+                return -1;
+            }
+            break;
+        case 'R':
+            server_config.history_retain_segments = atoi(optarg);
+            if (server_config.history_retain_segments <= 0) {
+                fprintf(stderr, "Error$ history segments kept must be positive\n");
+                return -1;
             }
+            break;
+        case 'L':
+            if (log_level_for(optarg) < 0) {
+                fprintf(stderr, "Error$ unknown log level '%s'\n", optarg);
+                return -1;
+            }
+            server_config.log_level = (log_level_t)log_level_for(optarg);
+            break;
+        case 'F':
+            server_config.log_path = optarg;
+            break;
+        case 'M':
+            server_config.stats_path = optarg;
+            break;
+        default:
+            return -1;
         }
-        
-        pthread_mutex_unlock(&ping_list.lock);
     }
-    
-    return NULL;
+    return 0;
+}
+
+// Event loop mode: make the shard's socket non-blocking and register it (plus the monitor timer on shard 0) with epoll
+// Returns 0 on success, -1 on failure
+int setup_event_loop(server_shard_t *shard) {
+    int flags = fcntl(shard->socket_descriptor, F_GETFL, 0);
+    if (flags < 0 || fcntl(shard->socket_descriptor, F_SETFL, flags | O_NONBLOCK) < 0) {
+        fprintf(stderr, "Error$ failed to make socket non-blocking\n");
+        return -1;
+    }
+
+    shard->epoll_fd = epoll_create1(0);
+    if (shard->epoll_fd < 0) {
+        fprintf(stderr, "Error$ epoll_create1 failed\n");
+        return -1;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = shard->socket_descriptor;
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->socket_descriptor, &event) < 0) {
+        fprintf(stderr, "Error$ failed to register socket with epoll\n");
+        return -1;
+    }
+
+    // The first loop takes over from monitor_thread: a timerfd fires every CLOCK_TICK_INTERVAL seconds to refresh
+    // the coarse clock and fire client timers, and every MONITOR_INTERVAL seconds' worth of ticks reports stats
+    shard->timer_fd = -1;
+    shard->timer_ticks = 0;
+    if (shard->index == 0) {
+        shard->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (shard->timer_fd < 0) {
+            fprintf(stderr, "Error$ timerfd_create failed\n");
+            return -1;
+        }
+
+        struct itimerspec interval;
+        interval.it_value.tv_sec = CLOCK_TICK_INTERVAL;
+        interval.it_value.tv_nsec = 0;
+        interval.it_interval = interval.it_value;
+        timerfd_settime(shard->timer_fd, 0, &interval, NULL);
+
+        event.events = EPOLLIN;
+        event.data.fd = shard->timer_fd;
+        if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->timer_fd, &event) < 0) {
+            fprintf(stderr, "Error$ failed to register monitor timer with epoll\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Open a shard's socket and start its worker pool and listener thread
+// Returns 0 on success, -1 on failure
+int start_shard(server_shard_t *shard, int index) {
+    shard->index = index;
+
+    // A single listener keeps the plain socket - SO_REUSEPORT is only needed to share the port
+    if (server_config.listener_count == 1) {
+        shard->socket_descriptor = udp_socket_open(SERVER_PORT);
+    } else {
+        shard->socket_descriptor = udp_socket_open_reuseport(SERVER_PORT);
+    }
+    if (shard->socket_descriptor < 0) {
+        fprintf(stderr, "Error$ failed to open socket for shard %d\n", index);
+        return -1;
+    }
+
+    if (server_config.event_loop) {
+        if (setup_event_loop(shard) != 0 ||
+            pthread_create(&shard->listener_tid, NULL, event_loop_thread, shard) != 0) {
+            fprintf(stderr, "Error$ failed to start event loop for shard %d\n", index);
+            return -1;
+        }
+        LOG_INFO("Shard %d started in event loop mode\n", index);
+        return 0;
+    }
+
+    //request queue init (all slots are allocated up front)
+    init_request_queue(&shard->queue, server_config.queue_capacity, server_config.overflow_policy);
+
+    //worker pool init - these threads live for the whole run of the server
+    shard->worker_tids = (pthread_t *)malloc(sizeof(pthread_t) * server_config.worker_count);
+    if (shard->worker_tids == NULL) {
+        fprintf(stderr, "Error$ failed to allocate worker pool\n");
+        return -1;
+    }
+    for (int i = 0; i < server_config.worker_count; i++) {
+        if (pthread_create(&shard->worker_tids[i], NULL, worker_thread, &shard->queue) != 0) {
+            fprintf(stderr, "Error$ worker thread creation error\n");
+            return -1;
+        }
+    }
+
+    //listener thread init
+    if (pthread_create(&shard->listener_tid, NULL, listener_thread, shard) != 0) {
+        fprintf(stderr, "Error$ listener thread creation error\n");
+        return -1;
+    }
+
+    LOG_INFO("Shard %d started with %d worker threads\n", index, server_config.worker_count);
+    return 0;
 }
 
+// chat_microbench.c includes this file for its data structures and defines CHAT_SERVER_NO_MAIN
+#ifndef CHAT_SERVER_NO_MAIN
 int main(int argc, char *argv[])
 {
+    if (parse_server_options(argc, argv) != 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    //logger init: lines go through per-thread rings to a drain thread, which is the only writer of the log file
+    FILE *log_file = stdout;
+    if (server_config.log_path != NULL) {
+        log_file = fopen(server_config.log_path, "a");
+        if (log_file == NULL) {
+            fprintf(stderr, "Error$ failed to open log file %s: %s\n", server_config.log_path, strerror(errno));
+            return 1;
+        }
+    }
+    log_set_level(server_config.log_level);
+    if (log_start(log_file) != 0) {
+        fprintf(stderr, "Error$ log drain thread creation error\n");
+        return 1;
+    }
 
-    // This function opens a UDP socket,
-    // binding it to all IP interfaces of this machine,
-    // and port number SERVER_PORT
-    // (See details of the function in udp.h)
-    int sd = udp_socket_open(SERVER_PORT);
+    //metrics init: counters need none, just the start time and the dump file if there is one
+    stats_start_time = time(NULL);
+    if (server_config.stats_path != NULL) {
+        stats_file = fopen(server_config.stats_path, "a");
+        if (stats_file == NULL) {
+            fprintf(stderr, "Error$ failed to open stats file %s: %s\n", server_config.stats_path, strerror(errno));
+            return 1;
+        }
+    }
 
-    assert(sd > -1);
+    //coarse clock init (before any client gets a timestamp)
+    refresh_coarse_clock();
+
+    //object slabs init (before anything allocates from them)
+    init_slabs();
 
     //client list init
     init_client_list();
     
-    //chat history init
-    init_chat_history();
+    //chat history init, refilled from the persistent log if there is one
+    init_history(&chat_history, server_config.history_depth);
+    if (server_config.history_directory != NULL && load_chat_history(server_config.history_directory) != 0) {
+        destroy_client_list();
+        log_stop();
+        return 1;
+    }
 
-    // Demo code (remove later)
-    printf("[DEBUG] Server is listening on port %d\n", SERVER_PORT);
+    // Initialize the timer wheel for inactivity pings
+    init_timer_wheel();
 
-    //listener thread init
-    pthread_t listener_tid;
-    //return 0 on success
-    int listener_thread_rc = pthread_create(&listener_tid, NULL, listener_thread, &sd);
+    // Command name index for routing requests
+    init_command_table();
 
-    if (listener_thread_rc != 0) {
-        fprintf(stderr, "Error$ listener thread creation error\n");
-        close(sd);
-        destroy_client_list();
+    // A single event loop runs every handler on one thread, so there is nothing to lock against
+    if (server_config.event_loop && server_config.listener_count == 1) {
+        locking_enabled = 0;
+    }
+
+    shards = (server_shard_t *)calloc(server_config.listener_count, sizeof(server_shard_t));
+    if (shards == NULL) {
+        fprintf(stderr, "Error$ failed to allocate shards\n");
         return 1;
     }
+
+    // Each shard opens a UDP socket bound to all IP interfaces of this machine
+    // and port number SERVER_PORT (see udp_socket_open and udp_socket_open_reuseport in udp.h)
+    for (int i = 0; i < server_config.listener_count; i++) {
+        if (start_shard(&shards[i], i) != 0) {
+            destroy_client_list();
+            destroy_timer_wheel();
+            log_stop();
+            return 1;
+        }
+    }
+
+    LOG_INFO("Server is listening on port %d with %d listener(s)\n", SERVER_PORT, server_config.listener_count);
     
-    // Initialize ping list
-    init_ping_list();
-    
-    // Create monitoring thread
-    pthread_t monitor_tid;
-    int monitor_thread_rc = pthread_create(&monitor_tid, NULL, monitor_thread, &sd);
-    
-    if (monitor_thread_rc != 0) {
-        fprintf(stderr, "Error$ monitor thread creation error\n");
-        close(sd);
-        destroy_client_list();
-        destroy_ping_list();
-        return 1;
+    // Create monitoring thread (pings and removal announcements go out through the first shard's socket)
+    // In event loop mode the first shard's timer does this job instead
+    if (!server_config.event_loop) {
+        pthread_t monitor_tid;
+        int monitor_thread_rc = pthread_create(&monitor_tid, NULL, monitor_thread, &shards[0].socket_descriptor);
+        
+        if (monitor_thread_rc != 0) {
+            fprintf(stderr, "Error$ monitor thread creation error\n");
+            destroy_client_list();
+            destroy_timer_wheel();
+            log_stop();
+            return 1;
+        }
     }
 
-    //keep listener thread alive
-    pthread_join(listener_tid, NULL);
+    //keep listener threads alive
+    for (int i = 0; i < server_config.listener_count; i++) {
+        pthread_join(shards[i].listener_tid, NULL);
+    }
 
     //cleanup
-    close(sd);
-    destroy_ping_list();  // Add this line
+    for (int i = 0; i < server_config.listener_count; i++) {
+        close(shards[i].socket_descriptor);
+        if (server_config.event_loop) {
+            close(shards[i].epoll_fd);
+            if (shards[i].timer_fd >= 0) {
+                close(shards[i].timer_fd);
+            }
+        } else {
+            destroy_request_queue(&shards[i].queue);
+            free(shards[i].worker_tids);
+        }
+    }
+    free(shards);
+    destroy_timer_wheel();
+    destroy_history(&chat_history);
     destroy_client_list();
+    destroy_slabs();
+
+    // Write out the lines still waiting in the log rings (including the ones logged by the cleanup above)
+    log_stop();
+    if (log_file != stdout) {
+        fclose(log_file);
+    }
     
     return 0;
 }
+#endif
@@ -0,0 +1,186 @@
+// Server metrics: request counts, error counts and handler latency per command, broadcast fan-out, send failures
+// and how often the shared locks were contended
+// Every thread counts into its own block, aligned to and padded out to whole cache lines, so threads never write
+// to a line another thread writes to. The counters are plain relaxed loads and stores (no locked instructions);
+// only the owner writes them, and stats_collect adds up every block for a report. The same struct holds the totals.
+//
+// Latencies and fan-outs go into log-bucketed histograms in the style of HdrHistogram: 4 buckets per power of two,
+// so a value is known to within 25% whatever its size, in a fixed 1.3 KB per histogram.
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define STATS_SUB_BUCKETS 4 // Buckets per power of two (power of two itself)
+#define STATS_BUCKETS 160   // Covers values up to 2^40 (about 18 minutes in ns); larger ones land in the last bucket
+
+// Shared locks whose contention is counted (by the lock wrappers in chat_server.c)
+typedef enum {
+    STATS_LOCK_CLIENT_LIST_READ,
+    STATS_LOCK_CLIENT_LIST_WRITE,
+    STATS_LOCK_HISTORY,
+    STATS_LOCK_TIMERS,
+    STATS_LOCK_COUNT
+} stats_lock_t;
+
+const char *stats_lock_names[STATS_LOCK_COUNT] = {"client_list_read", "client_list_write", "history", "timers"};
+
+typedef struct {
+    uint64_t requests[WIRE_OP_COUNT]; // Dispatched requests per opcode
+    uint64_t errors[WIRE_OP_COUNT];   // Requests rejected by the dispatcher or their handler
+    uint64_t unknown_commands;        // Text commands with no opcode
+    uint64_t invalid_requests;        // Requests that did not parse (no '$', bad frame)
+    uint64_t broadcasts;
+    uint64_t broadcast_recipients;
+    uint64_t send_failures;           // Datagrams the socket refused or the outbound queue dropped
+    uint64_t latency[WIRE_OP_COUNT][STATS_BUCKETS]; // Handler time in ns
+    uint64_t fanout[STATS_BUCKETS];   // Recipients per broadcast
+    uint64_t lock_acquisitions[STATS_LOCK_COUNT];
+    uint64_t lock_contended[STATS_LOCK_COUNT]; // Acquisitions that had to wait (the trylock failed)
+    uint64_t lock_wait_ns[STATS_LOCK_COUNT];   // Time those spent waiting
+} stats_counters_t;
+
+// One per thread that has ever counted something
+typedef struct stats_thread {
+    _Alignas(64) stats_counters_t counters;
+    struct stats_thread *next;
+} stats_thread_t;
+
+_Atomic(stats_thread_t *) stats_threads; // Only ever pushed onto, so stats_collect walks it without a lock
+__thread stats_thread_t *stats_self;
+time_t stats_start_time;
+
+// Histogram bucket for a value: exact below STATS_SUB_BUCKETS, then STATS_SUB_BUCKETS per power of two
+static inline int stats_bucket(uint64_t value) {
+    if (value < STATS_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int top_bit = 63 - __builtin_clzll(value);
+    int sub_bucket = (value >> (top_bit - 2)) & (STATS_SUB_BUCKETS - 1);
+    int bucket = (top_bit - 1) * STATS_SUB_BUCKETS + sub_bucket;
+    return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+// Largest value that lands in a bucket
+uint64_t stats_bucket_limit(int bucket) {
+    if (bucket < STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+    int top_bit = bucket / STATS_SUB_BUCKETS + 1;
+    uint64_t lowest = (uint64_t)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS) << (top_bit - 2);
+    return lowest + ((uint64_t)1 << (top_bit - 2)) - 1;
+}
+
+// This thread's counters, registered on first use (NULL if out of memory: the count is skipped)
+stats_counters_t *stats_counters() {
+    if (stats_self != NULL) {
+        return &stats_self->counters;
+    }
+    stats_thread_t *thread;
+    if (posix_memalign((void **)&thread, 64, sizeof(stats_thread_t)) != 0) {
+        return NULL;
+    }
+    memset(thread, 0, sizeof(stats_thread_t));
+    thread->next = atomic_load(&stats_threads);
+    while (!atomic_compare_exchange_weak(&stats_threads, &thread->next, thread)) {
+    }
+    stats_self = thread;
+    return &thread->counters;
+}
+
+// Add to one of this thread's counters (only the owning thread writes, so no read-modify-write is needed)
+static inline void stats_add(uint64_t *counter, uint64_t amount) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+static inline void stats_count(uint64_t *counter) {
+    stats_add(counter, 1);
+}
+
+// Time for latency measurements, in ns
+static inline uint64_t stats_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Count a dispatched request and how long its handler took
+void stats_record_request(int opcode, int rejected, uint64_t latency_ns) {
+    stats_counters_t *counters = stats_counters();
+    if (counters == NULL) {
+        return;
+    }
+    stats_count(&counters->requests[opcode]);
+    if (rejected) {
+        stats_count(&counters->errors[opcode]);
+    }
+    stats_count(&counters->latency[opcode][stats_bucket(latency_ns)]);
+}
+
+void stats_record_broadcast(int recipients) {
+    stats_counters_t *counters = stats_counters();
+    if (counters == NULL) {
+        return;
+    }
+    stats_count(&counters->broadcasts);
+    stats_add(&counters->broadcast_recipients, recipients);
+    stats_count(&counters->fanout[stats_bucket(recipients)]);
+}
+
+// Count a lock acquisition, and how long it waited if another thread held the lock
+void stats_record_lock(stats_lock_t lock, int contended, uint64_t wait_ns) {
+    stats_counters_t *counters = stats_counters();
+    if (counters == NULL) {
+        return;
+    }
+    stats_count(&counters->lock_acquisitions[lock]);
+    if (contended) {
+        stats_count(&counters->lock_contended[lock]);
+        stats_add(&counters->lock_wait_ns[lock], wait_ns);
+    }
+}
+
+// Count one event in a counter that is not per command (stats_record_event(unknown_commands) etc.)
+#define stats_record_event(field) do { \
+        stats_counters_t *stats_event_counters = stats_counters(); \
+        if (stats_event_counters != NULL) { \
+            stats_count(&stats_event_counters->field); \
+        } \
+    } while (0)
+
+// Add up every thread's counters into total (every field is a uint64_t, so they are summed as one array)
+void stats_collect(stats_counters_t *total) {
+    uint64_t *sum = (uint64_t *)total;
+    size_t fields = sizeof(stats_counters_t) / sizeof(uint64_t);
+    memset(total, 0, sizeof(stats_counters_t));
+    for (stats_thread_t *thread = atomic_load(&stats_threads); thread != NULL; thread = thread->next) {
+        uint64_t *counters = (uint64_t *)&thread->counters;
+        for (size_t i = 0; i < fields; i++) {
+            sum[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Smallest value that at least fraction of the histogram's samples are at or below (bucket precision)
+uint64_t stats_percentile(const uint64_t *buckets, double fraction) {
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        total += buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(fraction * total + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return stats_bucket_limit(i);
+        }
+    }
+    return stats_bucket_limit(STATS_BUCKETS - 1);
+}
@@ -0,0 +1,189 @@
+// Binary framing for the chat protocol, spoken by clients that ask for it (chat_client -b)
+// The text protocol ("command$ content\n") stays the default; a client chooses binary by sending its conn$
+// (or reconn$) as a frame, and from then on the server sends it frames too.
+//
+// A frame is a fixed 9-byte header followed by the payload, which is the text message's content
+// without the command, the "[seq] " and the trailing newline:
+//
+//   byte 0     version (WIRE_VERSION; its high bit is what tells a frame from a text request)
+//   byte 1     opcode  (one per command, see wire_command_names)
+//   byte 2     flags   (none defined yet, must be 0)
+//   bytes 3-6  seq     (big endian, low 32 bits of the history seq for say/history/histpack, otherwise 0)
+//   bytes 7-8  length  (big endian, payload bytes)
+//
+// A datagram can hold several frames back to back. The history is sent as HISTPACK frames instead, whose
+// payload is a run of messages with consecutive seqs from the header's, each a 2-byte big endian length
+// followed by the message.
+#include <stdint.h>
+#include <string.h>
+
+#define WIRE_VERSION 0x81
+#define WIRE_HEADER_SIZE 9
+
+typedef enum {
+    WIRE_TEXT,   // "command$ content\n" datagrams
+    WIRE_BINARY, // Frames
+    WIRE_FORMAT_COUNT
+} wire_format_t;
+
+typedef enum {
+    WIRE_OP_CONN = 1,
+    WIRE_OP_RECONN,   // seq = last seq the client has, payload = name
+    WIRE_OP_SAY,
+    WIRE_OP_SAYTO,
+    WIRE_OP_DISCONN,
+    WIRE_OP_MUTE,
+    WIRE_OP_UNMUTE,
+    WIRE_OP_RENAME,
+    WIRE_OP_KICK,
+    WIRE_OP_RET_PING,
+    WIRE_OP_PING,
+    WIRE_OP_HISTORY,
+    WIRE_OP_GAP,
+    WIRE_OP_ERROR,
+    WIRE_OP_HISTPACK, // seq = seq of the first message, payload = <length><message> records
+    WIRE_OP_STATS,
+    WIRE_OP_JOIN,
+    WIRE_OP_LEAVE,
+    WIRE_OP_COUNT
+} wire_opcode_t;
+
+// The text command each opcode stands for
+const char *wire_command_names[WIRE_OP_COUNT] = {
+    NULL, "conn", "reconn", "say", "sayto", "disconn", "mute", "unmute", "rename", "kick",
+    "ret-ping", "ping", "history", "gap", "Error", "histpack", "stats",
+    "join", "leave"
+};
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint32_t seq;
+    uint16_t length;
+} wire_header_t;
+
+// Command name -> opcode, as an open-addressing table hashed on the name's length and first and last
+// characters, so looking a name up costs one or two probes no matter how many commands there are
+#define WIRE_OPCODE_SLOTS 64 // Power of two, at least twice WIRE_OP_COUNT
+uint8_t wire_opcode_slots[WIRE_OPCODE_SLOTS]; // 0 = empty slot
+
+size_t wire_command_hash(const char *command, size_t length) {
+    return (length * 31 + (unsigned char)command[0] * 7 + (unsigned char)command[length - 1]) & (WIRE_OPCODE_SLOTS - 1);
+}
+
+// Fill wire_opcode_slots from wire_command_names (call once at startup, before wire_opcode_for)
+void wire_init_opcode_index() {
+    memset(wire_opcode_slots, 0, sizeof(wire_opcode_slots));
+    for (int op = 1; op < WIRE_OP_COUNT; op++) {
+        size_t slot = wire_command_hash(wire_command_names[op], strlen(wire_command_names[op]));
+        while (wire_opcode_slots[slot] != 0) {
+            slot = (slot + 1) & (WIRE_OPCODE_SLOTS - 1);
+        }
+        wire_opcode_slots[slot] = op;
+    }
+}
+
+// Opcode for a text command name, 0 if it has none
+int wire_opcode_for(const char *command, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+    for (size_t slot = wire_command_hash(command, length); wire_opcode_slots[slot] != 0; slot = (slot + 1) & (WIRE_OPCODE_SLOTS - 1)) {
+        const char *name = wire_command_names[wire_opcode_slots[slot]];
+        if (strncmp(name, command, length) == 0 && name[length] == '\0') {
+            return wire_opcode_slots[slot];
+        }
+    }
+    return 0;
+}
+
+// Write a frame header for a payload of length bytes into buffer
+void wire_encode_header(char *buffer, int opcode, uint32_t seq, int length) {
+    unsigned char *header = (unsigned char *)buffer;
+    header[0] = WIRE_VERSION;
+    header[1] = (unsigned char)opcode;
+    header[2] = 0;
+    header[3] = seq >> 24;
+    header[4] = seq >> 16;
+    header[5] = seq >> 8;
+    header[6] = seq;
+    header[7] = length >> 8;
+    header[8] = length;
+}
+
+// Write a frame into buffer
+// Returns the frame length, or -1 if it does not fit in capacity bytes
+int wire_encode(char *buffer, int capacity, int opcode, uint32_t seq, const char *payload, int length) {
+    if (length < 0 || length > 0xffff || WIRE_HEADER_SIZE + length > capacity) {
+        return -1;
+    }
+    wire_encode_header(buffer, opcode, seq, length);
+    memcpy(buffer + WIRE_HEADER_SIZE, payload, length);
+    return WIRE_HEADER_SIZE + length;
+}
+
+// Read the header of the frame at the start of buffer (n bytes available)
+// Returns 0 if a whole frame is there, -1 if it is not a frame, is cut short or has an unknown opcode
+int wire_decode(const char *buffer, int n, wire_header_t *header) {
+    const unsigned char *bytes = (const unsigned char *)buffer;
+    if (n < WIRE_HEADER_SIZE || bytes[0] != WIRE_VERSION) {
+        return -1;
+    }
+    header->opcode = bytes[1];
+    header->flags = bytes[2];
+    header->seq = (uint32_t)bytes[3] << 24 | (uint32_t)bytes[4] << 16 | (uint32_t)bytes[5] << 8 | bytes[6];
+    header->length = (uint16_t)(bytes[7] << 8 | bytes[8]);
+    if (header->opcode == 0 || header->opcode >= WIRE_OP_COUNT || WIRE_HEADER_SIZE + header->length > n) {
+        return -1;
+    }
+    return 0;
+}
+
+// Turn a text message ("command$ content", with or without a trailing newline) into a frame
+// With with_seq, a leading "[seq] " in the content moves into the header (server messages only: in a
+// request it is part of what the user typed)
+// Returns the frame length, or -1 if the command has no opcode or the frame does not fit
+int wire_encode_text(char *buffer, int capacity, const char *text, int n, int with_seq) {
+    const char *dollar_sign = memchr(text, '$', n);
+    if (dollar_sign == NULL) {
+        return -1;
+    }
+    int opcode = wire_opcode_for(text, dollar_sign - text);
+    if (opcode == 0) {
+        return -1;
+    }
+
+    const char *content = dollar_sign + 1;
+    const char *end = text + n;
+    if (end > content && end[-1] == '\n') {
+        end--;
+    }
+    while (content < end && *content == ' ') {
+        content++;
+    }
+
+    uint32_t seq = 0;
+    if (with_seq && content < end && *content == '[') {
+        const char *digit = content + 1;
+        uint64_t value = 0;
+        while (digit < end && *digit >= '0' && *digit <= '9') {
+            value = value * 10 + (*digit - '0');
+            digit++;
+        }
+        if (digit > content + 1 && digit + 1 < end && digit[0] == ']' && digit[1] == ' ') {
+            seq = (uint32_t)value;
+            content = digit + 2;
+        }
+    }
+    return wire_encode(buffer, capacity, opcode, seq, content, end - content);
+}
+
+// Recover a full seq from the 32 bits on the wire, taking the one closest to reference
+// (a seq the receiver already knows, such as the newest it has seen)
+uint64_t wire_widen_seq(uint32_t seq, uint64_t reference) {
+    uint64_t widened = reference + (int32_t)(seq - (uint32_t)reference);
+    if ((int32_t)(seq - (uint32_t)reference) < 0 && widened > reference) {
+        return seq; // Closest one would be below 0
+    }
+    return widened;
+}
@@ -0,0 +1,169 @@
+// Epoch-based reclamation
+// Lets readers use shared objects without taking a lock while writers replace and free them:
+// a reader brackets its accesses with epoch_enter/epoch_exit, a writer hands replaced objects
+// to epoch_retire, and an object is only freed once every thread that might still see it has left its epoch
+//
+// A global epoch counter only advances when every thread inside an epoch has observed the current value,
+// so anything retired two advances ago can no longer be referenced by anyone
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// One per thread that has ever entered an epoch
+typedef struct epoch_thread {
+    atomic_uint_fast64_t state; // 0 outside an epoch, (global epoch seen on entry << 1) | 1 inside one
+    int nesting;                // epoch_enter calls not yet matched by epoch_exit (owner thread only)
+    struct epoch_thread *next;
+} epoch_thread_t;
+
+// An object waiting for it to be safe to free
+typedef struct {
+    void *object;
+    void (*free_function)(void *);
+    uint64_t epoch; // Global epoch when it was retired
+} epoch_retired_t;
+
+typedef struct {
+    atomic_uint_fast64_t global_epoch;
+    epoch_thread_t *threads; // Every registered thread (protected by lock)
+    epoch_retired_t *retired; // Objects not freed yet (protected by lock)
+    size_t retired_count;
+    size_t retired_capacity;
+    unsigned long freed_total;
+    pthread_mutex_t lock;
+} epoch_domain_t;
+
+epoch_domain_t epoch_domain = {.lock = PTHREAD_MUTEX_INITIALIZER};
+__thread epoch_thread_t *epoch_self;
+
+// This thread's record, registered on first use
+epoch_thread_t *epoch_thread_record() {
+    if (epoch_self != NULL) {
+        return epoch_self;
+    }
+    epoch_thread_t *record = (epoch_thread_t *)calloc(1, sizeof(epoch_thread_t));
+    if (record == NULL) {
+        fprintf(stderr, "Failed to allocate epoch record\n");
+        exit(1);
+    }
+    pthread_mutex_lock(&epoch_domain.lock);
+    record->next = epoch_domain.threads;
+    epoch_domain.threads = record;
+    pthread_mutex_unlock(&epoch_domain.lock);
+    epoch_self = record;
+    return record;
+}
+
+// Start using shared objects (calls may nest)
+void epoch_enter() {
+    epoch_thread_t *self = epoch_thread_record();
+    if (self->nesting++ > 0) {
+        return;
+    }
+    // Epoch and active flag go in one store, so a reclaimer never pairs a stale epoch with a fresh flag
+    uint64_t global = atomic_load(&epoch_domain.global_epoch);
+    atomic_store_explicit(&self->state, (global << 1) | 1, memory_order_relaxed);
+    // The reclaimer must see us as active before we read any shared pointer
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+// Done with every shared object read since the matching epoch_enter
+void epoch_exit() {
+    epoch_thread_t *self = epoch_self;
+    if (--self->nesting > 0) {
+        return;
+    }
+    atomic_store_explicit(&self->state, 0, memory_order_release);
+}
+
+// Advance the global epoch if every active thread has caught up with it, then free what is safe to free
+void epoch_reclaim() {
+    pthread_mutex_lock(&epoch_domain.lock);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    uint64_t global = atomic_load(&epoch_domain.global_epoch);
+    int all_caught_up = 1;
+    for (epoch_thread_t *thread = epoch_domain.threads; thread != NULL; thread = thread->next) {
+        uint64_t state = atomic_load_explicit(&thread->state, memory_order_acquire);
+        if ((state & 1) && (state >> 1) != global) {
+            all_caught_up = 0;
+            break;
+        }
+    }
+    if (all_caught_up) {
+        global++;
+        atomic_store(&epoch_domain.global_epoch, global);
+    }
+
+    // Readers are at worst one epoch behind, so objects retired two epochs ago are unreachable
+    size_t kept = 0;
+    for (size_t i = 0; i < epoch_domain.retired_count; i++) {
+        epoch_retired_t *item = &epoch_domain.retired[i];
+        if (item->epoch + 2 <= global) {
+            item->free_function(item->object);
+            epoch_domain.freed_total++;
+        } else {
+            epoch_domain.retired[kept++] = *item;
+        }
+    }
+    epoch_domain.retired_count = kept;
+    pthread_mutex_unlock(&epoch_domain.lock);
+}
+
+// Free an object once no reader can still be using it
+// The object must already be unreachable for new readers
+void epoch_retire(void *object, void (*free_function)(void *)) {
+    if (object == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&epoch_domain.lock);
+    if (epoch_domain.retired_count == epoch_domain.retired_capacity) {
+        size_t new_capacity = epoch_domain.retired_capacity == 0 ? 64 : epoch_domain.retired_capacity * 2;
+        epoch_retired_t *grown = (epoch_retired_t *)realloc(epoch_domain.retired, sizeof(epoch_retired_t) * new_capacity);
+        if (grown == NULL) {
+            // Leaking is the only safe choice: a reader may still hold the object
+            pthread_mutex_unlock(&epoch_domain.lock);
+            fprintf(stderr, "Failed to grow the retired object list\n");
+            return;
+        }
+        epoch_domain.retired = grown;
+        epoch_domain.retired_capacity = new_capacity;
+    }
+    epoch_retired_t *item = &epoch_domain.retired[epoch_domain.retired_count++];
+    item->object = object;
+    item->free_function = free_function;
+    item->epoch = atomic_load(&epoch_domain.global_epoch);
+    pthread_mutex_unlock(&epoch_domain.lock);
+}
+
+// Objects still waiting to be freed
+size_t epoch_pending() {
+    pthread_mutex_lock(&epoch_domain.lock);
+    size_t pending = epoch_domain.retired_count;
+    pthread_mutex_unlock(&epoch_domain.lock);
+    return pending;
+}
+
+// Free everything still retired (only once no thread will read shared objects again)
+void epoch_destroy() {
+    pthread_mutex_lock(&epoch_domain.lock);
+    for (size_t i = 0; i < epoch_domain.retired_count; i++) {
+        epoch_domain.retired[i].free_function(epoch_domain.retired[i].object);
+    }
+    free(epoch_domain.retired);
+    epoch_domain.retired = NULL;
+    epoch_domain.retired_count = 0;
+    epoch_domain.retired_capacity = 0;
+
+    epoch_thread_t *thread = epoch_domain.threads;
+    while (thread != NULL) {
+        epoch_thread_t *next = thread->next;
+        free(thread);
+        thread = next;
+    }
+    epoch_domain.threads = NULL;
+    epoch_self = NULL;
+    pthread_mutex_unlock(&epoch_domain.lock);
+}
@@ -0,0 +1,404 @@
+// Append-only chat history log, kept on disk so history survives a restart
+// The log is a directory of segment files named after the sequence number of their first record
+// (00000000000000000001.log, ...). The newest segment is mapped with mmap and records are copied straight
+// into it; when it fills up it is trimmed to its used length and a new one is started, and the oldest
+// segments beyond the retention limit are deleted.
+//
+// Each record is a log_record_header_t followed by the payload, padded to 8 bytes. The header is written
+// after the payload and carries a CRC of both, and the unused part of a segment is zero, so after a crash
+// the scan stops at the first record that is empty, torn or out of sequence: at most the record being
+// written is lost.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOG_INDEX_INTERVAL 64            // Records between sparse index entries
+#define LOG_MAX_RECORD_LENGTH (1 << 16)  // Longer lengths can only come from a damaged header
+#define LOG_MIN_SEGMENT_SIZE (64 * 1024)
+#define LOG_PATH_LEN 4096
+#define LOG_SEGMENT_NAME_LEN 25 // "/<20-digit seq>.log"
+#define LOG_DIRECTORY_LEN (LOG_PATH_LEN - LOG_SEGMENT_NAME_LEN) // Longer directories are rejected, so segment paths always fit
+
+typedef struct {
+    uint32_t crc;    // CRC-32 of seq, length and payload
+    uint32_t length; // Payload bytes (0 marks the end of the segment)
+    uint64_t seq;
+} log_record_header_t;
+
+// Every LOG_INDEX_INTERVAL-th record of the active segment, so a replay can start near any seq
+typedef struct {
+    uint64_t seq;
+    size_t offset;
+} log_index_entry_t;
+
+typedef struct {
+    char directory[LOG_DIRECTORY_LEN];
+    size_t segment_size;  // Bytes reserved for each new segment
+    int retain_segments;  // Segments kept on disk, the active one included
+
+    // First seq of every segment on disk, oldest first
+    uint64_t *segments;
+    int segment_count;
+    int segment_capacity;
+
+    // Active (newest) segment
+    int fd;
+    char *map;
+    size_t map_size;      // Bytes mapped (more than segment_size if the segment was made with a larger one)
+    size_t used;          // Bytes of valid records
+    uint64_t next_seq;    // seq the next record must have
+    log_index_entry_t *index;
+    size_t index_count;
+    size_t index_capacity;
+} history_log_t;
+
+// Called for each record replayed, in seq order
+typedef void (*log_replay_fn)(uint64_t seq, const char *data, uint32_t length, void *arg);
+
+uint32_t log_crc_table[256];
+
+void log_crc_init() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        log_crc_table[i] = c;
+    }
+}
+
+uint32_t log_crc_update(uint32_t crc, const void *data, size_t length) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < length; i++) {
+        crc = log_crc_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+uint32_t log_record_crc(uint64_t seq, uint32_t length, const char *payload) {
+    uint32_t crc = 0xffffffffu;
+    crc = log_crc_update(crc, &seq, sizeof(seq));
+    crc = log_crc_update(crc, &length, sizeof(length));
+    crc = log_crc_update(crc, payload, length);
+    return crc ^ 0xffffffffu;
+}
+
+size_t log_record_size(uint32_t length) {
+    return (sizeof(log_record_header_t) + length + 7) & ~(size_t)7;
+}
+
+void log_segment_path(history_log_t *log, uint64_t first_seq, char *path) {
+    snprintf(path, LOG_PATH_LEN, "%s/%020llu.log", log->directory, (unsigned long long)first_seq);
+}
+
+int log_compare_seq(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int log_add_segment(history_log_t *log, uint64_t first_seq) {
+    if (log->segment_count == log->segment_capacity) {
+        int new_capacity = log->segment_capacity == 0 ? 16 : log->segment_capacity * 2;
+        uint64_t *grown = (uint64_t *)realloc(log->segments, sizeof(uint64_t) * new_capacity);
+        if (grown == NULL) {
+            return -1;
+        }
+        log->segments = grown;
+        log->segment_capacity = new_capacity;
+    }
+    log->segments[log->segment_count++] = first_seq;
+    return 0;
+}
+
+int log_add_index_entry(history_log_t *log, uint64_t seq, size_t offset) {
+    if (log->index_count == log->index_capacity) {
+        size_t new_capacity = log->index_capacity == 0 ? 64 : log->index_capacity * 2;
+        log_index_entry_t *grown = (log_index_entry_t *)realloc(log->index, sizeof(log_index_entry_t) * new_capacity);
+        if (grown == NULL) {
+            return -1;
+        }
+        log->index = grown;
+        log->index_capacity = new_capacity;
+    }
+    log->index[log->index_count].seq = seq;
+    log->index[log->index_count].offset = offset;
+    log->index_count++;
+    return 0;
+}
+
+// Check the record at offset: returns its size, or 0 if it is the end of the valid records
+size_t log_check_record(const char *map, size_t size, size_t offset, uint64_t expected_seq) {
+    if (offset + sizeof(log_record_header_t) > size) {
+        return 0;
+    }
+    const log_record_header_t *header = (const log_record_header_t *)(map + offset);
+    if (header->length == 0 || header->length > LOG_MAX_RECORD_LENGTH || header->seq != expected_seq) {
+        return 0;
+    }
+    size_t record_size = log_record_size(header->length);
+    if (offset + record_size > size) {
+        return 0;
+    }
+    if (log_record_crc(header->seq, header->length, (const char *)(header + 1)) != header->crc) {
+        return 0;
+    }
+    return record_size;
+}
+
+// Map the segment starting at first_seq (creating it if needed) and make it the active one
+// Scans the existing records, rebuilding the sparse index, and zeroes anything after the last valid one
+int log_open_active_segment(history_log_t *log, uint64_t first_seq) {
+    char path[LOG_PATH_LEN];
+    log_segment_path(log, first_seq, path);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open history segment %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    // Reserve the blocks now, so a full disk fails here rather than with SIGBUS when a record is copied in
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size < log->segment_size && posix_fallocate(fd, 0, log->segment_size) != 0)) {
+        fprintf(stderr, "Failed to size history segment %s\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size > log->segment_size ? (size_t)st.st_size : log->segment_size;
+    char *map = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map history segment %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    log->fd = fd;
+    log->map = map;
+    log->map_size = size;
+    log->index_count = 0;
+
+    size_t offset = 0;
+    uint64_t seq = first_seq;
+    size_t record_size;
+    while ((record_size = log_check_record(map, size, offset, seq)) != 0) {
+        if ((seq - first_seq) % LOG_INDEX_INTERVAL == 0 && log_add_index_entry(log, seq, offset) != 0) {
+            // Leave no half-open segment behind (and no trim: the records past this point are still valid)
+            fprintf(stderr, "Failed to index history segment %s\n", path);
+            munmap(map, size);
+            close(fd);
+            log->map = NULL;
+            log->fd = -1;
+            log->map_size = 0;
+            log->index_count = 0;
+            return -1;
+        }
+        offset += record_size;
+        seq++;
+    }
+    // A torn record from a crash is overwritten by the next append; clear it so it cannot be misread later
+    size_t leftover = size - offset < log_record_size(LOG_MAX_RECORD_LENGTH) ? size - offset : log_record_size(LOG_MAX_RECORD_LENGTH);
+    memset(map + offset, 0, leftover);
+
+    log->used = offset;
+    log->next_seq = seq;
+    return 0;
+}
+
+// Trim the active segment to its records and unmap it
+void log_close_active_segment(history_log_t *log) {
+    if (log->map == NULL) {
+        return;
+    }
+    munmap(log->map, log->map_size);
+    if (ftruncate(log->fd, log->used) != 0) {
+        fprintf(stderr, "Failed to trim history segment: %s\n", strerror(errno));
+    }
+    close(log->fd);
+    log->map = NULL;
+    log->fd = -1;
+}
+
+// Open (or create) the log in directory and map its newest segment
+// Returns 0 on success, -1 on failure
+int history_log_open(history_log_t *log, const char *directory, size_t segment_size, int retain_segments) {
+    memset(log, 0, sizeof(*log));
+    log->fd = -1;
+    if (strlen(directory) >= LOG_DIRECTORY_LEN) {
+        fprintf(stderr, "History directory path is too long (at most %d characters)\n", LOG_DIRECTORY_LEN - 1);
+        return -1;
+    }
+    snprintf(log->directory, LOG_DIRECTORY_LEN, "%s", directory);
+    log->segment_size = segment_size < LOG_MIN_SEGMENT_SIZE ? LOG_MIN_SEGMENT_SIZE : segment_size;
+    log->retain_segments = retain_segments < 1 ? 1 : retain_segments;
+    log_crc_init();
+
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create history directory %s: %s\n", directory, strerror(errno));
+        return -1;
+    }
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        fprintf(stderr, "Failed to open history directory %s: %s\n", directory, strerror(errno));
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned long long first_seq;
+        char suffix[8];
+        if (strlen(entry->d_name) == 24 && sscanf(entry->d_name, "%20llu.%3s", &first_seq, suffix) == 2 &&
+            strcmp(suffix, "log") == 0 && first_seq > 0) {
+            if (log_add_segment(log, first_seq) != 0) {
+                closedir(dir);
+                return -1;
+            }
+        }
+    }
+    closedir(dir);
+    if (log->segment_count == 0) {
+        if (log_add_segment(log, 1) != 0) {
+            return -1;
+        }
+    } else {
+        qsort(log->segments, log->segment_count, sizeof(uint64_t), log_compare_seq);
+    }
+    return log_open_active_segment(log, log->segments[log->segment_count - 1]);
+}
+
+// Close the active segment and start a new one at next_seq, deleting segments beyond the retention limit
+int log_rotate(history_log_t *log) {
+    log_close_active_segment(log);
+    if (log_add_segment(log, log->next_seq) != 0 || log_open_active_segment(log, log->next_seq) != 0) {
+        return -1;
+    }
+    while (log->segment_count > log->retain_segments) {
+        char path[LOG_PATH_LEN];
+        log_segment_path(log, log->segments[0], path);
+        if (unlink(path) != 0) {
+            fprintf(stderr, "Failed to delete history segment %s: %s\n", path, strerror(errno));
+        }
+        memmove(log->segments, log->segments + 1, sizeof(uint64_t) * (log->segment_count - 1));
+        log->segment_count--;
+    }
+    return 0;
+}
+
+// Append a record; seq must be next_seq
+// Returns 0 on success, -1 on failure (the log should not be used again)
+int history_log_append(history_log_t *log, uint64_t seq, const char *data, uint32_t length) {
+    if (log->map == NULL || seq != log->next_seq || length == 0 || length > LOG_MAX_RECORD_LENGTH) {
+        return -1;
+    }
+    size_t record_size = log_record_size(length);
+    if (log->used + record_size > log->map_size && log_rotate(log) != 0) {
+        return -1;
+    }
+
+    // Payload first, header last: a record without its header reads as the end of the log
+    log_record_header_t *header = (log_record_header_t *)(log->map + log->used);
+    memcpy(header + 1, data, length);
+    log_record_header_t complete = {log_record_crc(seq, length, data), length, seq};
+    memcpy(header, &complete, sizeof(complete));
+
+    if ((seq - log->segments[log->segment_count - 1]) % LOG_INDEX_INTERVAL == 0) {
+        log_add_index_entry(log, seq, log->used); // A missing index entry only makes replays scan further
+    }
+    log->used += record_size;
+    log->next_seq++;
+    return 0;
+}
+
+// Replay every record of one segment from from_seq on
+// Returns the next seq expected after the segment's last valid record
+uint64_t log_replay_segment(const char *map, size_t size, uint64_t seq, size_t offset, uint64_t from_seq,
+                            log_replay_fn callback, void *arg) {
+    size_t record_size;
+    while ((record_size = log_check_record(map, size, offset, seq)) != 0) {
+        if (seq >= from_seq) {
+            const log_record_header_t *header = (const log_record_header_t *)(map + offset);
+            callback(seq, (const char *)(header + 1), header->length, arg);
+        }
+        offset += record_size;
+        seq++;
+    }
+    return seq;
+}
+
+// Oldest seq still on disk
+uint64_t history_log_first_seq(history_log_t *log) {
+    return log->segment_count > 0 ? log->segments[0] : log->next_seq;
+}
+
+// Call callback for every record with seq >= from_seq, oldest first
+// Older segments are mapped read-only and scanned; the active one is entered through its sparse index
+// Returns the number of records replayed, or -1 if a segment could not be read
+long history_log_replay(history_log_t *log, uint64_t from_seq, log_replay_fn callback, void *arg) {
+    long replayed = 0;
+    int first = log->segment_count - 1;
+    while (first > 0 && log->segments[first] > from_seq) {
+        first--;
+    }
+
+    for (int i = first; i < log->segment_count; i++) {
+        uint64_t before = i == log->segment_count - 1 ? log->next_seq : log->segments[i + 1];
+        if (before <= from_seq) {
+            continue;
+        }
+        if (i == log->segment_count - 1) {
+            // Start from the last index entry at or before from_seq
+            uint64_t seq = log->segments[i];
+            size_t offset = 0;
+            for (size_t k = 0; k < log->index_count && log->index[k].seq <= from_seq; k++) {
+                seq = log->index[k].seq;
+                offset = log->index[k].offset;
+            }
+            uint64_t start = seq > from_seq ? seq : from_seq;
+            replayed += log_replay_segment(log->map, log->used, seq, offset, from_seq, callback, arg) - start;
+            continue;
+        }
+
+        char path[LOG_PATH_LEN];
+        log_segment_path(log, log->segments[i], path);
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "Failed to open history segment %s: %s\n", path, strerror(errno));
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        if (st.st_size > 0) {
+            char *map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                fprintf(stderr, "Failed to map history segment %s: %s\n", path, strerror(errno));
+                close(fd);
+                return -1;
+            }
+            uint64_t start = log->segments[i] > from_seq ? log->segments[i] : from_seq;
+            uint64_t end = log_replay_segment(map, st.st_size, log->segments[i], 0, from_seq, callback, arg);
+            if (end > start) {
+                replayed += end - start;
+            }
+            munmap(map, st.st_size);
+        }
+        close(fd);
+    }
+    return replayed;
+}
+
+void history_log_close(history_log_t *log) {
+    log_close_active_segment(log);
+    free(log->segments);
+    free(log->index);
+    log->segments = NULL;
+    log->index = NULL;
+    log->segment_count = 0;
+    log->index_count = 0;
+}
@@ -0,0 +1,233 @@
+// Fixed-size slab allocator with per-thread caches
+// Used by the server for objects it creates and frees on the hot path
+// (client nodes, muted name entries, client timers, queued outbound datagrams)
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define SLAB_CHUNK_OBJECTS 64 // Objects carved out of each malloc'd chunk
+#define SLAB_CACHE_SIZE 32    // A thread cache flushes half its objects back once it holds more than this
+#define SLAB_MAX_TYPES 16     // Max number of slabs (each thread has one cache per slab)
+
+// A free object is reused to hold the free-list link
+typedef struct slab_object {
+    struct slab_object *next;
+} slab_object_t;
+
+// One thread's private stash of free objects for one slab
+// Allocating and freeing only touch this, so threads do not contend on the slab lock
+typedef struct slab_cache {
+    slab_object_t *head;
+    atomic_int count;          // Written by the owning thread, read by slab_get_stats
+    struct slab_cache *next;   // All caches of a slab, for stats
+} slab_cache_t;
+
+typedef struct {
+    const char *name;
+    size_t object_size;
+    int id; // Position of this slab's cache in every thread's cache array
+
+    // Shared free list, refilled from new chunks (protected by lock)
+    slab_object_t *free_list;
+    size_t free_count;
+    void **chunks; // Every chunk ever allocated, freed by slab_destroy
+    int chunk_count;
+    int chunk_capacity;
+    size_t total_objects; // Objects ever carved (live + free)
+
+    slab_cache_t *caches; // Every thread cache registered with this slab
+    pthread_mutex_t lock;
+} slab_t;
+
+typedef struct {
+    size_t live;  // Objects handed out and not yet freed
+    size_t free;  // Objects ready for reuse (shared list + thread caches)
+    size_t total; // live + free: the slab never gives memory back, so this is its peak
+} slab_stats_t;
+
+int slab_count = 0;
+__thread slab_cache_t *slab_thread_caches[SLAB_MAX_TYPES];
+
+int slab_init(slab_t *slab, const char *name, size_t object_size) {
+    if (slab_count >= SLAB_MAX_TYPES) {
+        return -1;
+    }
+    if (object_size < sizeof(slab_object_t)) {
+        object_size = sizeof(slab_object_t);
+    }
+    // Keep every object aligned for any type
+    object_size = (object_size + 15) & ~(size_t)15;
+
+    slab->name = name;
+    slab->object_size = object_size;
+    slab->id = slab_count++;
+    slab->free_list = NULL;
+    slab->free_count = 0;
+    slab->chunks = NULL;
+    slab->chunk_count = 0;
+    slab->chunk_capacity = 0;
+    slab->total_objects = 0;
+    slab->caches = NULL;
+    return pthread_mutex_init(&slab->lock, NULL);
+}
+
+// Carve a new chunk into objects on the shared free list (slab lock must be held)
+int slab_grow_locked(slab_t *slab) {
+    if (slab->chunk_count == slab->chunk_capacity) {
+        int new_capacity = slab->chunk_capacity == 0 ? 16 : slab->chunk_capacity * 2;
+        void **grown = (void **)realloc(slab->chunks, sizeof(void *) * new_capacity);
+        if (grown == NULL) {
+            return -1;
+        }
+        slab->chunks = grown;
+        slab->chunk_capacity = new_capacity;
+    }
+
+    char *chunk = (char *)malloc(slab->object_size * SLAB_CHUNK_OBJECTS);
+    if (chunk == NULL) {
+        return -1;
+    }
+    slab->chunks[slab->chunk_count++] = chunk;
+
+    for (int i = 0; i < SLAB_CHUNK_OBJECTS; i++) {
+        slab_object_t *object = (slab_object_t *)(chunk + i * slab->object_size);
+        object->next = slab->free_list;
+        slab->free_list = object;
+    }
+    slab->free_count += SLAB_CHUNK_OBJECTS;
+    slab->total_objects += SLAB_CHUNK_OBJECTS;
+    return 0;
+}
+
+// This thread's cache for a slab, created on first use
+slab_cache_t *slab_thread_cache(slab_t *slab) {
+    slab_cache_t *cache = slab_thread_caches[slab->id];
+    if (cache != NULL) {
+        return cache;
+    }
+
+    cache = (slab_cache_t *)calloc(1, sizeof(slab_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&slab->lock);
+    cache->next = slab->caches;
+    slab->caches = cache;
+    pthread_mutex_unlock(&slab->lock);
+
+    slab_thread_caches[slab->id] = cache;
+    return cache;
+}
+
+// Returns an uninitialised object, or NULL if out of memory
+void *slab_alloc(slab_t *slab) {
+    slab_cache_t *cache = slab_thread_cache(slab);
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    if (cache->head == NULL) {
+        // Cache empty: take half a cache's worth from the shared list in one lock acquisition
+        pthread_mutex_lock(&slab->lock);
+        if (slab->free_list == NULL && slab_grow_locked(slab) != 0) {
+            pthread_mutex_unlock(&slab->lock);
+            return NULL;
+        }
+        int moved = 0;
+        while (slab->free_list != NULL && moved < SLAB_CACHE_SIZE / 2) {
+            slab_object_t *object = slab->free_list;
+            slab->free_list = object->next;
+            object->next = cache->head;
+            cache->head = object;
+            moved++;
+        }
+        slab->free_count -= moved;
+        pthread_mutex_unlock(&slab->lock);
+        atomic_fetch_add_explicit(&cache->count, moved, memory_order_relaxed);
+    }
+
+    slab_object_t *object = cache->head;
+    cache->head = object->next;
+    atomic_fetch_sub_explicit(&cache->count, 1, memory_order_relaxed);
+    return object;
+}
+
+// Objects may be freed by a different thread than the one that allocated them
+void slab_free(slab_t *slab, void *pointer) {
+    if (pointer == NULL) {
+        return;
+    }
+
+    slab_cache_t *cache = slab_thread_cache(slab);
+    slab_object_t *object = (slab_object_t *)pointer;
+    if (cache == NULL) {
+        // No cache for this thread: hand the object straight back to the shared list
+        pthread_mutex_lock(&slab->lock);
+        object->next = slab->free_list;
+        slab->free_list = object;
+        slab->free_count++;
+        pthread_mutex_unlock(&slab->lock);
+        return;
+    }
+
+    object->next = cache->head;
+    cache->head = object;
+    int count = atomic_fetch_add_explicit(&cache->count, 1, memory_order_relaxed) + 1;
+
+    if (count > SLAB_CACHE_SIZE) {
+        // Cache too full: give half back so other threads can use it
+        int to_move = count / 2;
+        pthread_mutex_lock(&slab->lock);
+        for (int i = 0; i < to_move; i++) {
+            slab_object_t *moved = cache->head;
+            cache->head = moved->next;
+            moved->next = slab->free_list;
+            slab->free_list = moved;
+        }
+        slab->free_count += to_move;
+        pthread_mutex_unlock(&slab->lock);
+        atomic_fetch_sub_explicit(&cache->count, to_move, memory_order_relaxed);
+    }
+}
+
+// Snapshot of how many objects are in use and how many are waiting for reuse
+// (thread cache counts are read without stopping their owners, so this is approximate under load)
+slab_stats_t slab_get_stats(slab_t *slab) {
+    slab_stats_t stats;
+    pthread_mutex_lock(&slab->lock);
+    size_t free_objects = slab->free_count;
+    for (slab_cache_t *cache = slab->caches; cache != NULL; cache = cache->next) {
+        free_objects += atomic_load_explicit(&cache->count, memory_order_relaxed);
+    }
+    stats.total = slab->total_objects;
+    pthread_mutex_unlock(&slab->lock);
+
+    stats.free = free_objects;
+    stats.live = stats.total - stats.free;
+    return stats;
+}
+
+// Free every chunk (only once no thread will touch the slab again)
+void slab_destroy(slab_t *slab) {
+    pthread_mutex_lock(&slab->lock);
+    for (int i = 0; i < slab->chunk_count; i++) {
+        free(slab->chunks[i]);
+    }
+    free(slab->chunks);
+    slab->chunks = NULL;
+    slab->chunk_count = 0;
+    slab->free_list = NULL;
+    slab->free_count = 0;
+    slab->total_objects = 0;
+
+    slab_cache_t *cache = slab->caches;
+    while (cache != NULL) {
+        slab_cache_t *next = cache->next;
+        free(cache);
+        cache = next;
+    }
+    slab->caches = NULL;
+    pthread_mutex_unlock(&slab->lock);
+    pthread_mutex_destroy(&slab->lock);
+}
@@ -7,10 +7,12 @@
 #include <arpa/inet.h>  // inet_pton(), inet_ntop()
 #include <unistd.h>     // close()
 #include <string.h>     // memset(), memcpy()
+#include <errno.h>      // errno, EAGAIN
 #include <assert.h>
 
 #define BUFFER_SIZE 1024
 #define SERVER_PORT 12000
+#define UDP_BATCH_SIZE 32 // Max datagrams moved per recvmmsg/sendmmsg call
 
 int set_socket_addr(struct sockaddr_in *addr, const char *ip, int port)
 {
@@ -66,6 +68,39 @@ int udp_socket_open(int port)
     return sd; // return the socket descriptor
 }
 
+int udp_socket_open_reuseport(int port)
+{
+    // Same as udp_socket_open, but sets SO_REUSEPORT before binding so that
+    // several sockets can bind the same port. The kernel then spreads incoming
+    // datagrams across those sockets by hashing the sender's address, so all
+    // datagrams from one client always land on the same socket.
+    // Returns the socket descriptor, or -1 on error.
+
+    int sd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sd < 0)
+    {
+        return -1;
+    }
+
+    int enable = 1;
+    if (setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+    {
+        close(sd);
+        return -1;
+    }
+
+    struct sockaddr_in this_addr;
+    set_socket_addr(&this_addr, NULL, port);
+
+    if (bind(sd, (struct sockaddr *)&this_addr, sizeof(this_addr)) < 0)
+    {
+        close(sd);
+        return -1;
+    }
+
+    return sd;
+}
+
 int udp_socket_read(int sd, struct sockaddr_in *addr, char *buffer, int n)
 {
     // Receive up to n bytes into buffer from the socket with descriptor sd.
@@ -82,6 +117,43 @@ int udp_socket_read(int sd, struct sockaddr_in *addr, char *buffer, int n)
     return recvfrom(sd, buffer, n, 0, (struct sockaddr *)addr, &len);
 }
 
+int udp_socket_read_batch(int sd, struct sockaddr_in *addrs, char (*buffers)[BUFFER_SIZE], int *lengths, int max_messages)
+{
+    // Batched version of udp_socket_read built on recvmmsg (needs _GNU_SOURCE).
+    // Blocks until at least one datagram arrives, then also takes whatever else
+    // is already queued on the socket (up to max_messages) in the same syscall.
+    // Datagram i is stored in buffers[i] (at most BUFFER_SIZE - 1 bytes, so the
+    // caller can null terminate it), its length in lengths[i] and its sender in addrs[i].
+    // Returns the number of datagrams received, or -1 on error.
+
+    struct mmsghdr msgs[UDP_BATCH_SIZE];
+    struct iovec iovecs[UDP_BATCH_SIZE];
+
+    if (max_messages > UDP_BATCH_SIZE)
+    {
+        max_messages = UDP_BATCH_SIZE;
+    }
+
+    memset(msgs, 0, sizeof(struct mmsghdr) * max_messages);
+    for (int i = 0; i < max_messages; i++)
+    {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = BUFFER_SIZE - 1;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    // MSG_WAITFORONE: block for the first datagram only, never wait for a full batch
+    int count = recvmmsg(sd, msgs, max_messages, MSG_WAITFORONE, NULL);
+    for (int i = 0; i < count; i++)
+    {
+        lengths[i] = msgs[i].msg_len;
+    }
+    return count;
+}
+
 int udp_socket_write(int sd, struct sockaddr_in *addr, char *buffer, int n)
 {
     // Send the contents of buffer (n bytes) to the given destination
@@ -100,4 +172,62 @@ int udp_socket_write(int sd, struct sockaddr_in *addr, char *buffer, int n)
 
     int addr_len = sizeof(struct sockaddr_in);
     return sendto(sd, buffer, n, 0, (struct sockaddr *)addr, addr_len);
-}
\ No newline at end of file
+}
+
+int udp_socket_write_batch(int sd, struct sockaddr_in *addrs, int count, char *buffer, int n, int *skipped)
+{
+    // Fan-out version of udp_socket_write built on sendmmsg (needs _GNU_SOURCE).
+    // Sends the same buffer (n bytes) to every one of the count addresses,
+    // UDP_BATCH_SIZE destinations per syscall instead of one.
+    // A destination that fails is skipped so it does not cut off everyone after it,
+    // and counted in *skipped (if skipped is not NULL).
+    // Returns how many destinations were handled (sent or skipped). This is only
+    // less than count on a non-blocking socket whose send buffer filled up (errno
+    // is then EAGAIN); the caller can retry addrs[return value] onwards later.
+
+    struct mmsghdr msgs[UDP_BATCH_SIZE];
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = n;
+
+    int attempted = 0;
+    if (skipped != NULL)
+    {
+        *skipped = 0;
+    }
+    while (attempted < count)
+    {
+        int chunk = count - attempted;
+        if (chunk > UDP_BATCH_SIZE)
+        {
+            chunk = UDP_BATCH_SIZE;
+        }
+
+        memset(msgs, 0, sizeof(struct mmsghdr) * chunk);
+        for (int i = 0; i < chunk; i++)
+        {
+            // Every message shares the one iovec, only the destination differs
+            msgs[i].msg_hdr.msg_iov = &iov;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[attempted + i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+
+        int rc = sendmmsg(sd, msgs, chunk, 0);
+        if (rc < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break; // Non-blocking socket is full: leave the rest to the caller
+            }
+            attempted++; // The first datagram of this chunk failed: skip that destination
+            if (skipped != NULL)
+            {
+                (*skipped)++;
+            }
+            continue;
+        }
+        attempted += rc;
+    }
+    return attempted;
+}